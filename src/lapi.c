@@ -23,6 +23,7 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "lsort.h"
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
@@ -536,6 +537,21 @@ LUA_API size_t lua_stringtonumber (lua_State *L, const char *s) {
 }
 
 
+LUA_API int lua_integer2buff (char *buff, lua_Integer i) {
+  return luaO_int2str(buff, i);
+}
+
+
+LUA_API int lua_number2buff (char *buff, lua_Number x) {
+  return luaO_flt2str(buff, x);
+}
+
+
+LUA_API int lua_fixed2buff (char *buff, lua_Number x, int prec) {
+  return luaO_fixed2str(buff, x, prec);
+}
+
+
 /*
  * Converts the Lua value at the given index to the C type 
  * lua_Number (see lua_Number). The Lua value must be a number
@@ -699,6 +715,18 @@ LUA_API void *lua_touserdata (lua_State *L, int idx) {
   }
 }
 
+
+LUA_API void *lua_toarray (lua_State *L, int idx, int *type, size_t *n) {
+  StkId o = index2addr(L, idx);
+  Udata *u;
+  if (!ttisfulluserdata(o) || uvalue(o)->arraytype == 0)
+    return NULL;
+  u = uvalue(o);
+  if (type) *type = u->arraytype;
+  if (n) *n = arraylen(u);
+  return getudatamem(u);
+}
+
 /*
  * Converts the value at the given index to a Lua thread (represented
  * as lua_State*). This value must be a thread; otherwise, the function
@@ -794,6 +822,27 @@ LUA_API const char *lua_pushlstring (lua_State *L, const char *s, size_t len) {
   return getstr(ts);
 }
 
+
+/*
+ * Pushes a string of length len whose bytes stay at s, which must be
+ * followed by a '\0'. When the string is collected (or at once, if it
+ * is short enough to be copied), Lua calls release(ud, s, len), which
+ * must not call Lua. If this function raises an error, s is not
+ * released and still belongs to the caller.
+ */
+LUA_API const char *lua_pushexternalstring (lua_State *L, const char *s,
+                                   size_t len, lua_Release release, void *ud) {
+  TString *ts;
+  lua_lock(L);
+  api_check(s[len] == '\0', "string not ending with '\\0'");
+  luaC_checkGC(L);
+  ts = luaS_newextlstr(L, s, len, release, ud);
+  setsvalue2s(L, L->top, ts);
+  api_incr_top(L);
+  lua_unlock(L);
+  return getstr(ts);
+}
+
 /*
  * Pushes the zero-terminated string pointed to by s onto the stack.
  * Lua makes (or reuses) an internal copy of the given string, so the
@@ -1124,6 +1173,37 @@ LUA_API void lua_createtable (lua_State *L, int narray, int nrec) {
 }
 
 
+/*
+ * Makes sure the table at the given index has room for at least
+ * narray sequence elements and nrec other elements without a rehash.
+ * The table never shrinks.
+ */
+LUA_API void lua_reservetable (lua_State *L, int idx, int narray, int nrec) {
+  StkId t;
+  lua_lock(L);
+  luaC_checkGC(L);
+  t = index2addr(L, idx);
+  api_check(ttistable(t), "table expected");
+  api_check(narray >= 0 && nrec >= 0, "negative size");
+  luaH_reserve(L, hvalue(t), narray, nrec);
+  lua_unlock(L);
+}
+
+
+/*
+ * Removes all entries of the table at the given index (raw, without
+ * metamethods), keeping the memory it uses for later insertions.
+ */
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  StkId t;
+  lua_lock(L);
+  t = index2addr(L, idx);
+  api_check(ttistable(t), "table expected");
+  luaH_clear(hvalue(t));
+  lua_unlock(L);
+}
+
+
 /*
  * If the value at the given index has a metatable, the function pushes
  * that metatable onto the stack and returns 1. Otherwise, the function
@@ -1761,6 +1841,109 @@ LUA_API void lua_len (lua_State *L, int idx) {
   lua_unlock(L);
 }
 
+LUA_API int lua_sort (lua_State *L, int idx, lua_Integer n, int comp) {
+  StkId t;
+  int res;
+  lua_lock(L);
+  t = index2addr(L, idx);
+  api_check(ttistable(t), "table expected");
+  api_check(comp == 0 || ttisfunction(index2addr(L, comp)),
+            "function expected");
+  res = luaH_sort(L, hvalue(t), n, (comp == 0) ? NULL : index2addr(L, comp));
+  lua_unlock(L);
+  return res;
+}
+
+
+LUA_API size_t lua_getnumbers (lua_State *L, int idx, lua_Integer i,
+                               size_t n, lua_Number *buf) {
+  StkId t;
+  Table *h;
+  size_t k;
+  lua_lock(L);
+  t = index2addr(L, idx);
+  api_check(ttistable(t), "table expected");
+  h = hvalue(t);
+  for (k = 0; k < n; k++) {
+    lua_Unsigned j = l_castS2U(i) + k - 1;  /* C index of 't[i + k]' */
+    const TValue *o;
+    if (j >= h->sizearray) break;
+    o = &h->array[j];
+    if (ttisfloat(o)) buf[k] = fltvalue(o);
+    else if (ttisinteger(o)) buf[k] = cast_num(ivalue(o));
+    else break;
+  }
+  lua_unlock(L);
+  return k;
+}
+
+
+LUA_API size_t lua_setnumbers (lua_State *L, int idx, lua_Integer i,
+                               size_t n, const lua_Number *buf) {
+  StkId t;
+  Table *h;
+  size_t k;
+  lua_lock(L);
+  t = index2addr(L, idx);
+  api_check(ttistable(t), "table expected");
+  h = hvalue(t);
+  for (k = 0; k < n; k++) {
+    lua_Unsigned j = l_castS2U(i) + k - 1;
+    TValue *o;
+    if (j >= h->sizearray) break;
+    o = &h->array[j];
+    if (!ttisnumber(o)) break;  /* only replace numbers (no barrier) */
+    setfltvalue(o, buf[k]);
+  }
+  lua_unlock(L);
+  return k;
+}
+
+
+LUA_API size_t lua_getintegers (lua_State *L, int idx, lua_Integer i,
+                                size_t n, lua_Integer *buf) {
+  StkId t;
+  Table *h;
+  size_t k;
+  lua_lock(L);
+  t = index2addr(L, idx);
+  api_check(ttistable(t), "table expected");
+  h = hvalue(t);
+  for (k = 0; k < n; k++) {
+    lua_Unsigned j = l_castS2U(i) + k - 1;  /* C index of 't[i + k]' */
+    const TValue *o;
+    if (j >= h->sizearray) break;
+    o = &h->array[j];
+    if (!ttisinteger(o)) break;
+    buf[k] = ivalue(o);
+  }
+  lua_unlock(L);
+  return k;
+}
+
+
+LUA_API size_t lua_setintegers (lua_State *L, int idx, lua_Integer i,
+                                size_t n, const lua_Integer *buf) {
+  StkId t;
+  Table *h;
+  size_t k;
+  lua_lock(L);
+  t = index2addr(L, idx);
+  api_check(ttistable(t), "table expected");
+  h = hvalue(t);
+  for (k = 0; k < n; k++) {
+    lua_Unsigned j = l_castS2U(i) + k - 1;
+    TValue *o;
+    if (j >= h->sizearray) break;
+    o = &h->array[j];
+    if (!ttisnumber(o)) break;  /* only replace numbers (no barrier) */
+    setivalue(o, buf[k]);
+  }
+  lua_unlock(L);
+  return k;
+}
+
+
 /*
  * Returns the memory-allocation function of a given state. If 
  * ud is not NULL, Lua stores in *ud the opaque pointer given 
@@ -1810,6 +1993,26 @@ LUA_API void *lua_newuserdata (lua_State *L, size_t size) {
 }
 
 
+LUA_API void *lua_newarray (lua_State *L, int type, size_t n) {
+  Udata *u;
+  size_t size;
+  lua_lock(L);
+  api_check(LUA_AINTEGER <= type && type <= LUA_AFLOAT32,
+            "invalid array type");
+  luaC_checkGC(L);
+  size = arrayelemsize(type);
+  if (n > (MAX_SIZE - sizeof(Udata)) / size)
+    luaM_toobig(L);
+  u = luaS_newudata(L, n * size);
+  u->arraytype = cast_byte(type);
+  memset(getudatamem(u), 0, n * size);
+  setuvalue(L, L->top, u);
+  api_incr_top(L);
+  lua_unlock(L);
+  return getudatamem(u);
+}
+
+
 
 /**
  * fi: 函数位置
@@ -1957,10 +2160,13 @@ LUA_API void *lua_upvalueid (lua_State *L, int fidx, int n) {
 /* 并更改相关引用次数 */
 LUA_API void lua_upvaluejoin (lua_State *L, int fidx1, int n1,
                                             int fidx2, int n2) {
-  LClosure *f1;
+  LClosure *f1, *f2;
   UpVal **up1 = getupvalref(L, fidx1, n1, &f1);
-  UpVal **up2 = getupvalref(L, fidx2, n2, NULL);
-  luaC_upvdeccount(L, *up1);
+  UpVal **up2 = getupvalref(L, fidx2, n2, &f2);
+  if (isflatupval(f2, *up2))  /* flat upvalues cannot be shared */
+    luaF_unflatupval(L, f2, n2 - 1);
+  if (!isflatupval(f1, *up1))  /* (flat ones go with their closure) */
+    luaC_upvdeccount(L, *up1);
   *up1 = *up2;
   (*up1)->refcount++;
   if (upisopen(*up1)) (*up1)->u.open.touched = 1;
@@ -0,0 +1,940 @@
+/*
+** $Id: larraylib.c $
+** Standard library for typed arrays
+** See Copyright Notice in lua.h
+*/
+
+#define larraylib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <math.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+#if defined(LUA_USE_SIMD) && defined(LUA_REAL_DOUBLE)
+#include <immintrin.h>
+#define SIMD_KERNELS
+#endif
+
+
+/*
+** Typed arrays are fixed-size vectors of unboxed numbers. The core
+** indexes them directly (see 'lua_newarray'); this library only
+** creates them and converts them to and from tables and strings.
+*/
+
+#define ARRAYMT		"array"
+
+
+/* ORDER LUA_A* */
+static const char *const typenames[] =
+  {"integer", "float", "int32", "float32", NULL};
+
+#define checktype(L,arg)	(luaL_checkoption(L, arg, NULL, typenames) + 1)
+
+
+static char *checkarray (lua_State *L, int arg, int *type, size_t *n) {
+  void *a = lua_toarray(L, arg, type, n);
+  luaL_argcheck(L, a != NULL, arg, "typed array expected");
+  return (char *)a;
+}
+
+
+static void *newarray (lua_State *L, int type, size_t n) {
+  void *a = lua_newarray(L, type, n);
+  luaL_setmetatable(L, ARRAYMT);
+  return a;
+}
+
+
+/*
+** array.new(type, n) creates an array with 'n' zeros; array.new(type, t)
+** creates an array with the elements of sequence 't'.
+*/
+static int anew (lua_State *L) {
+  int type = checktype(L, 1);
+  if (lua_istable(L, 2)) {
+    lua_Integer n = luaL_len(L, 2);
+    lua_Integer i;
+    newarray(L, type, (size_t)n);
+    for (i = 1; i <= n; i++) {
+      lua_geti(L, 2, i);
+      lua_seti(L, -2, i);
+    }
+  }
+  else {
+    lua_Integer n = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, n >= 0, 2, "invalid size");
+    newarray(L, type, (size_t)n);
+  }
+  return 1;
+}
+
+
+static int atype (lua_State *L) {
+  int type;
+  luaL_checkany(L, 1);
+  if (lua_toarray(L, 1, &type, NULL) != NULL)
+    lua_pushstring(L, typenames[type - 1]);
+  else
+    lua_pushnil(L);
+  return 1;
+}
+
+
+/* translate a relative position (negative means back from end) */
+static lua_Integer posrelat (lua_Integer pos, size_t len) {
+  if (pos >= 0) return pos;
+  else if (0u - (size_t)pos > len) return 0;
+  else return (lua_Integer)len + pos + 1;
+}
+
+
+/*
+** Raw memory of elements 'i' to 'j', in the format of 'string.pack'
+** with native sizes and endianness ("=j", "=n", "=i4", "=f"). As in
+** 'string.sub', negative positions count back from the end.
+*/
+static int tobytes (lua_State *L) {
+  int type;
+  size_t n;
+  const char *a = checkarray(L, 1, &type, &n);
+  size_t size = lua_arrayelemsize(type);
+  lua_Integer i = posrelat(luaL_optinteger(L, 2, 1), n);
+  lua_Integer j = posrelat(luaL_optinteger(L, 3, -1), n);
+  if (i < 1) i = 1;
+  if ((lua_Unsigned)j > n) j = (lua_Integer)n;
+  if (i > j)
+    lua_pushliteral(L, "");
+  else
+    lua_pushlstring(L, a + (size_t)(i - 1) * size, (size_t)(j - i + 1) * size);
+  return 1;
+}
+
+
+static int frombytes (lua_State *L) {
+  int type = checktype(L, 1);
+  size_t len;
+  const char *s = luaL_checklstring(L, 2, &len);
+  size_t size = lua_arrayelemsize(type);
+  luaL_argcheck(L, len % size == 0, 2, "length not a multiple of element size");
+  memcpy(newarray(L, type, len / size), s, len);
+  return 1;
+}
+
+
+static int totable (lua_State *L) {
+  size_t n, i;
+  checkarray(L, 1, NULL, &n);
+  lua_createtable(L, (int)n, 0);
+  for (i = 1; i <= n; i++) {
+    lua_geti(L, 1, (lua_Integer)i);
+    lua_rawseti(L, -2, (lua_Integer)i);
+  }
+  return 1;
+}
+
+
+/*
+** {======================================================
+** Bulk operations
+** =======================================================
+*/
+
+/*
+** Bulk operations work on sequences given either as tables or as typed
+** arrays, in chunks of CHUNK elements. As in Lua arithmetic, a chunk
+** of integers with integer operands is computed with integers (which
+** wrap around); otherwise it is computed with floats. (So, a chunk that
+** mixes integers and floats gives only floats.) Float results stored
+** into integer arrays must have an exact integer representation, as in
+** an assignment; otherwise the operation raises an error.
+**
+** Arrays of 'lua_Number' or 'lua_Integer' are used in place; table
+** entries go in and out of a buffer through lua_getnumbers/
+** lua_setnumbers (or their integer versions); anything these do not
+** handle (holes, entries in the hash part, strings, other arrays) goes
+** through lua_geti/lua_seti, with the usual metamethods and conversions.
+*/
+
+#define CHUNK		256
+
+
+/*
+** Kernels over C arrays of floats, written once in terms of a vector
+** type VTYPE with VLEN lanes and instantiated for plain C or, with
+** SIMD_KERNELS, for SSE2 and AVX2 (chosen at run time). Reductions are
+** done in an unspecified order.
+*/
+#define KERNELS(K) \
+\
+static KATTR lua_Number ksum##K (const lua_Number *x, size_t n) { \
+  VTYPE a0 = VZERO, a1 = VZERO; \
+  lua_Number t[VLEN]; \
+  lua_Number s = 0; \
+  size_t i, k; \
+  for (i = 0; i + 2 * VLEN <= n; i += 2 * VLEN) { \
+    a0 = VADD(a0, VLOAD(x + i)); \
+    a1 = VADD(a1, VLOAD(x + i + VLEN)); \
+  } \
+  VSTORE(t, VADD(a0, a1)); \
+  for (k = 0; k < VLEN; k++) s += t[k]; \
+  for (; i < n; i++) s += x[i]; \
+  return s; \
+} \
+\
+static KATTR lua_Number kdot##K (const lua_Number *x, const lua_Number *y, \
+                                 size_t n) { \
+  VTYPE a0 = VZERO, a1 = VZERO; \
+  lua_Number t[VLEN]; \
+  lua_Number s = 0; \
+  size_t i, k; \
+  for (i = 0; i + 2 * VLEN <= n; i += 2 * VLEN) { \
+    a0 = VADD(a0, VMUL(VLOAD(x + i), VLOAD(y + i))); \
+    a1 = VADD(a1, VMUL(VLOAD(x + i + VLEN), VLOAD(y + i + VLEN))); \
+  } \
+  VSTORE(t, VADD(a0, a1)); \
+  for (k = 0; k < VLEN; k++) s += t[k]; \
+  for (; i < n; i++) s += x[i] * y[i]; \
+  return s; \
+} \
+\
+/* update '*lo' and '*hi' with the elements of 'x' */ \
+static KATTR void kminmax##K (const lua_Number *x, size_t n, \
+                              lua_Number *lo, lua_Number *hi) { \
+  lua_Number t[VLEN]; \
+  size_t i = 0, k; \
+  if (n >= VLEN) { \
+    VTYPE vlo = VLOAD(x); \
+    VTYPE vhi = vlo; \
+    for (i = VLEN; i + VLEN <= n; i += VLEN) { \
+      VTYPE v = VLOAD(x + i); \
+      vlo = VMIN(vlo, v); \
+      vhi = VMAX(vhi, v); \
+    } \
+    VSTORE(t, vlo); \
+    for (k = 0; k < VLEN; k++) if (t[k] < *lo) *lo = t[k]; \
+    VSTORE(t, vhi); \
+    for (k = 0; k < VLEN; k++) if (t[k] > *hi) *hi = t[k]; \
+  } \
+  for (; i < n; i++) { \
+    if (x[i] < *lo) *lo = x[i]; \
+    if (x[i] > *hi) *hi = x[i]; \
+  } \
+} \
+\
+/* y = a*x + y */ \
+static KATTR void kaxpy##K (lua_Number a, const lua_Number *x, \
+                            lua_Number *y, size_t n) { \
+  VTYPE va = VSPLAT(a); \
+  size_t i; \
+  for (i = 0; i + VLEN <= n; i += VLEN) \
+    VSTORE(y + i, VADD(VLOAD(y + i), VMUL(va, VLOAD(x + i)))); \
+  for (; i < n; i++) y[i] += a * x[i]; \
+} \
+\
+static KATTR void kscale##K (lua_Number a, lua_Number *x, size_t n) { \
+  VTYPE va = VSPLAT(a); \
+  size_t i; \
+  for (i = 0; i + VLEN <= n; i += VLEN) \
+    VSTORE(x + i, VMUL(VLOAD(x + i), va)); \
+  for (; i < n; i++) x[i] *= a; \
+} \
+\
+/* NaNs become 'lo' */ \
+static KATTR void kclamp##K (lua_Number lo, lua_Number hi, lua_Number *x, \
+                             size_t n) { \
+  VTYPE vlo = VSPLAT(lo), vhi = VSPLAT(hi); \
+  size_t i; \
+  for (i = 0; i + VLEN <= n; i += VLEN) \
+    VSTORE(x + i, VMIN(VMAX(VLOAD(x + i), vlo), vhi)); \
+  for (; i < n; i++) { \
+    lua_Number v = (x[i] > lo) ? x[i] : lo; \
+    x[i] = (v < hi) ? v : hi; \
+  } \
+} \
+\
+static KATTR void ksqrt##K (lua_Number *x, size_t n) { \
+  size_t i; \
+  for (i = 0; i + VLEN <= n; i += VLEN) \
+    VSTORE(x + i, VSQRT(VLOAD(x + i))); \
+  for (; i < n; i++) x[i] = l_mathop(sqrt)(x[i]); \
+} \
+\
+static KATTR void kabs##K (lua_Number *x, size_t n) { \
+  size_t i; \
+  for (i = 0; i + VLEN <= n; i += VLEN) \
+    VSTORE(x + i, VABS(VLOAD(x + i))); \
+  for (; i < n; i++) x[i] = l_mathop(fabs)(x[i]); \
+}
+
+
+typedef struct Kernels {
+  lua_Number (*sum) (const lua_Number *x, size_t n);
+  lua_Number (*dot) (const lua_Number *x, const lua_Number *y, size_t n);
+  void (*minmax) (const lua_Number *x, size_t n, lua_Number *lo,
+                  lua_Number *hi);
+  void (*axpy) (lua_Number a, const lua_Number *x, lua_Number *y, size_t n);
+  void (*scale) (lua_Number a, lua_Number *x, size_t n);
+  void (*clamp) (lua_Number lo, lua_Number hi, lua_Number *x, size_t n);
+  void (*sqrt) (lua_Number *x, size_t n);
+  void (*abs) (lua_Number *x, size_t n);
+} Kernels;
+
+#define KTABLE(K)  { ksum##K, kdot##K, kminmax##K, kaxpy##K, kscale##K, \
+                     kclamp##K, ksqrt##K, kabs##K }
+
+
+#if defined(SIMD_KERNELS)
+
+#define KATTR
+#define VTYPE		__m128d
+#define VLEN		2
+#define VZERO		_mm_setzero_pd()
+#define VLOAD(p)	_mm_loadu_pd(p)
+#define VSTORE(p,v)	_mm_storeu_pd(p, v)
+#define VSPLAT(x)	_mm_set1_pd(x)
+#define VADD(a,b)	_mm_add_pd(a, b)
+#define VMUL(a,b)	_mm_mul_pd(a, b)
+#define VMIN(a,b)	_mm_min_pd(a, b)
+#define VMAX(a,b)	_mm_max_pd(a, b)
+#define VSQRT(a)	_mm_sqrt_pd(a)
+#define VABS(a)		_mm_andnot_pd(_mm_set1_pd(-0.0), a)
+
+KERNELS(sse2)
+
+static const Kernels kernels_sse2 = KTABLE(sse2);
+
+#undef KATTR
+#undef VTYPE
+#undef VLEN
+#undef VZERO
+#undef VLOAD
+#undef VSTORE
+#undef VSPLAT
+#undef VADD
+#undef VMUL
+#undef VMIN
+#undef VMAX
+#undef VSQRT
+#undef VABS
+
+#define KATTR		__attribute__((target("avx2")))
+#define VTYPE		__m256d
+#define VLEN		4
+#define VZERO		_mm256_setzero_pd()
+#define VLOAD(p)	_mm256_loadu_pd(p)
+#define VSTORE(p,v)	_mm256_storeu_pd(p, v)
+#define VSPLAT(x)	_mm256_set1_pd(x)
+#define VADD(a,b)	_mm256_add_pd(a, b)
+#define VMUL(a,b)	_mm256_mul_pd(a, b)
+#define VMIN(a,b)	_mm256_min_pd(a, b)
+#define VMAX(a,b)	_mm256_max_pd(a, b)
+#define VSQRT(a)	_mm256_sqrt_pd(a)
+#define VABS(a)		_mm256_andnot_pd(_mm256_set1_pd(-0.0), a)
+
+KERNELS(avx2)
+
+static const Kernels kernels_avx2 = KTABLE(avx2);
+
+
+static const Kernels *getkernels (void) {
+  return __builtin_cpu_supports("avx2") ? &kernels_avx2 : &kernels_sse2;
+}
+
+#else
+
+/* plain C: min/max as in SSE2 (second operand when unordered) */
+#define KATTR
+#define VTYPE		lua_Number
+#define VLEN		1
+#define VZERO		0
+#define VLOAD(p)	(*(p))
+#define VSTORE(p,v)	(*(p) = (v))
+#define VSPLAT(x)	(x)
+#define VADD(a,b)	((a) + (b))
+#define VMUL(a,b)	((a) * (b))
+#define VMIN(a,b)	(((a) < (b)) ? (a) : (b))
+#define VMAX(a,b)	(((a) > (b)) ? (a) : (b))
+#define VSQRT(a)	l_mathop(sqrt)(a)
+#define VABS(a)		l_mathop(fabs)(a)
+
+KERNELS(c)
+
+static const Kernels kernels_c = KTABLE(c);
+
+#define getkernels()	(&kernels_c)
+
+#endif
+
+
+typedef struct Vec {
+  lua_State *L;
+  int arg;  /* stack index of the table or array */
+  int type;  /* LUA_A* for a typed array, 0 for a table */
+  void *mem;  /* elements of a typed array */
+  lua_Integer n;  /* number of elements */
+} Vec;
+
+
+static void checkvec (lua_State *L, int arg, Vec *v) {
+  size_t n;
+  v->L = L;
+  v->arg = arg;
+  v->mem = lua_toarray(L, arg, &v->type, &n);
+  if (v->mem != NULL)
+    v->n = (lua_Integer)n;
+  else {
+    luaL_checktype(L, arg, LUA_TTABLE);
+    v->type = 0;
+    v->n = luaL_len(L, arg);
+  }
+}
+
+
+/* number of elements in the chunk starting at 'i' */
+#define chunklen(v,i)  \
+  ((size_t)((v)->n - (i) < CHUNK ? (v)->n - (i) + 1 : CHUNK))
+
+
+static lua_Number getelem (Vec *v, lua_Integer i) {
+  lua_State *L = v->L;
+  int isnum;
+  lua_Number x;
+  lua_geti(L, v->arg, i);
+  x = lua_tonumberx(L, -1, &isnum);
+  if (!isnum)
+    luaL_error(L, "number expected at index %I, got %s", i,
+                  luaL_typename(L, -1));
+  lua_pop(L, 1);
+  return x;
+}
+
+
+/*
+** Elements 'i' to 'i + m - 1' as floats: either the array itself or a
+** copy in 'buf'
+*/
+static lua_Number *getchunk (Vec *v, lua_Integer i, size_t m,
+                             lua_Number *buf) {
+  size_t k = 0;
+  if (v->type == LUA_AFLOAT)
+    return (lua_Number *)v->mem + (i - 1);
+  else if (v->type == LUA_AFLOAT32) {
+    const float *p = (const float *)v->mem + (i - 1);
+    for (; k < m; k++) buf[k] = (lua_Number)p[k];
+  }
+  else if (v->type == 0)
+    k = lua_getnumbers(v->L, v->arg, i, m, buf);
+  for (; k < m; k++)
+    buf[k] = getelem(v, i + (lua_Integer)k);
+  return buf;
+}
+
+
+/* store back a chunk got with 'getchunk' */
+static void putchunk (Vec *v, lua_Integer i, size_t m, const lua_Number *p) {
+  size_t k = 0;
+  if (v->type == LUA_AFLOAT)
+    return;  /* changed in place */
+  else if (v->type == LUA_AFLOAT32) {
+    float *q = (float *)v->mem + (i - 1);
+    for (; k < m; k++) q[k] = lua_numbertofloat(p[k]);
+  }
+  else if (v->type == 0)
+    k = lua_setnumbers(v->L, v->arg, i, m, p);
+  for (; k < m; k++) {
+    lua_pushnumber(v->L, p[k]);
+    lua_seti(v->L, v->arg, i + (lua_Integer)k);
+  }
+}
+
+
+/*
+** Elements 'i' to 'i + m - 1' as integers: either the array itself or
+** a copy in 'buf'; NULL if some of them are not integers.
+*/
+static lua_Integer *getintchunk (Vec *v, lua_Integer i, size_t m,
+                                 lua_Integer *buf) {
+  lua_State *L = v->L;
+  size_t k = 0;
+  if (v->type == LUA_AINTEGER)
+    return (lua_Integer *)v->mem + (i - 1);
+  else if (v->type == LUA_AINT32) {
+    const LUA_INT32 *p = (const LUA_INT32 *)v->mem + (i - 1);
+    for (; k < m; k++) buf[k] = p[k];
+    return buf;
+  }
+  else if (v->type != 0)
+    return NULL;  /* float array */
+  k = lua_getintegers(L, v->arg, i, m, buf);
+  for (; k < m; k++) {
+    int isint;
+    lua_geti(L, v->arg, i + (lua_Integer)k);
+    isint = lua_isinteger(L, -1);
+    buf[k] = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    if (!isint) return NULL;
+  }
+  return buf;
+}
+
+
+/* store back a chunk got with 'getintchunk' */
+static void putintchunk (Vec *v, lua_Integer i, size_t m,
+                         const lua_Integer *p) {
+  size_t k = 0;
+  if (v->type == LUA_AINTEGER)
+    return;  /* changed in place */
+  else if (v->type == LUA_AINT32) {
+    LUA_INT32 *q = (LUA_INT32 *)v->mem + (i - 1);
+    for (; k < m; k++) {
+      if ((lua_Unsigned)p[k] + 0x80000000u > 0xFFFFFFFFu)  /* no fit? */
+        luaL_error(v->L, "value out of range for int32 array element");
+      q[k] = (LUA_INT32)p[k];
+    }
+    return;
+  }
+  k = lua_setintegers(v->L, v->arg, i, m, p);
+  for (; k < m; k++) {
+    lua_pushinteger(v->L, p[k]);
+    lua_seti(v->L, v->arg, i + (lua_Integer)k);
+  }
+}
+
+
+/*
+** Kernels over C arrays of integers, with the wrap-around of Lua
+** integer arithmetic
+*/
+
+#define intop(op,a,b)  \
+	((lua_Integer)((lua_Unsigned)(a) op (lua_Unsigned)(b)))
+
+static lua_Integer isum (const lua_Integer *x, size_t n) {
+  lua_Integer s = 0;
+  size_t i;
+  for (i = 0; i < n; i++) s = intop(+, s, x[i]);
+  return s;
+}
+
+static lua_Integer idot (const lua_Integer *x, const lua_Integer *y,
+                         size_t n) {
+  lua_Integer s = 0;
+  size_t i;
+  for (i = 0; i < n; i++) s = intop(+, s, intop(*, x[i], y[i]));
+  return s;
+}
+
+static void iminmax (const lua_Integer *x, size_t n, lua_Integer *lo,
+                     lua_Integer *hi) {
+  size_t i;
+  for (i = 0; i < n; i++) {
+    if (x[i] < *lo) *lo = x[i];
+    if (x[i] > *hi) *hi = x[i];
+  }
+}
+
+static void iaxpy (lua_Integer a, const lua_Integer *x, lua_Integer *y,
+                   size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++) y[i] = intop(+, intop(*, a, x[i]), y[i]);
+}
+
+static void iscale (lua_Integer a, lua_Integer *x, size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++) x[i] = intop(*, a, x[i]);
+}
+
+static void iclamp (lua_Integer lo, lua_Integer hi, lua_Integer *x,
+                    size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++)
+    x[i] = (x[i] < lo) ? lo : (x[i] > hi) ? hi : x[i];
+}
+
+static void iabs (lua_Integer *x, size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++)
+    if (x[i] < 0) x[i] = intop(-, 0, x[i]);
+}
+
+
+static int bsum (lua_State *L) {
+  const Kernels *K = getkernels();
+  lua_Number buf[CHUNK];
+  lua_Integer ibuf[CHUNK];
+  lua_Number s = 0;
+  lua_Integer is = 0;
+  int isint = 1;  /* all chunks so far were integers? */
+  lua_Integer i;
+  Vec v;
+  checkvec(L, 1, &v);
+  for (i = 1; i <= v.n; i += CHUNK) {
+    size_t m = chunklen(&v, i);
+    const lua_Integer *q;
+    if (isint && (q = getintchunk(&v, i, m, ibuf)) != NULL)
+      is = intop(+, is, isum(q, m));
+    else {
+      if (isint) { s = (lua_Number)is; isint = 0; }
+      s += K->sum(getchunk(&v, i, m, buf), m);
+    }
+  }
+  if (isint) lua_pushinteger(L, is);
+  else lua_pushnumber(L, s);
+  return 1;
+}
+
+
+static int minmax (lua_State *L, int ismax) {
+  const Kernels *K = getkernels();
+  lua_Number buf[CHUNK];
+  lua_Integer ibuf[CHUNK];
+  lua_Number lo = 0, hi = 0;
+  lua_Integer ilo = 0, ihi = 0;
+  const lua_Integer *q;
+  int isint;
+  lua_Integer i;
+  Vec v;
+  checkvec(L, 1, &v);
+  if (v.n == 0) {
+    lua_pushnil(L);  /* empty sequence */
+    return 1;
+  }
+  q = getintchunk(&v, 1, 1, ibuf);
+  if ((isint = (q != NULL)) != 0)
+    ilo = ihi = q[0];
+  else
+    lo = hi = getchunk(&v, 1, 1, buf)[0];
+  for (i = 1; i <= v.n; i += CHUNK) {
+    size_t m = chunklen(&v, i);
+    if (isint && (q = getintchunk(&v, i, m, ibuf)) != NULL)
+      iminmax(q, m, &ilo, &ihi);
+    else {
+      if (isint) { lo = (lua_Number)ilo; hi = (lua_Number)ihi; isint = 0; }
+      K->minmax(getchunk(&v, i, m, buf), m, &lo, &hi);
+    }
+  }
+  if (isint) lua_pushinteger(L, ismax ? ihi : ilo);
+  else lua_pushnumber(L, ismax ? hi : lo);
+  return 1;
+}
+
+
+static int bmin (lua_State *L) {
+  return minmax(L, 0);
+}
+
+
+static int bmax (lua_State *L) {
+  return minmax(L, 1);
+}
+
+
+static int bdot (lua_State *L) {
+  const Kernels *K = getkernels();
+  lua_Number xbuf[CHUNK], ybuf[CHUNK];
+  lua_Integer ixbuf[CHUNK], iybuf[CHUNK];
+  lua_Number s = 0;
+  lua_Integer is = 0;
+  int isint = 1;  /* all chunks so far were integers? */
+  lua_Integer i;
+  Vec x, y;
+  checkvec(L, 1, &x);
+  checkvec(L, 2, &y);
+  luaL_argcheck(L, x.n == y.n, 2, "sequences of different lengths");
+  for (i = 1; i <= x.n; i += CHUNK) {
+    size_t m = chunklen(&x, i);
+    const lua_Integer *qx, *qy;
+    if (isint && (qx = getintchunk(&x, i, m, ixbuf)) != NULL &&
+                 (qy = getintchunk(&y, i, m, iybuf)) != NULL)
+      is = intop(+, is, idot(qx, qy, m));
+    else {
+      if (isint) { s = (lua_Number)is; isint = 0; }
+      s += K->dot(getchunk(&x, i, m, xbuf), getchunk(&y, i, m, ybuf), m);
+    }
+  }
+  if (isint) lua_pushinteger(L, is);
+  else lua_pushnumber(L, s);
+  return 1;
+}
+
+
+/* axpy(a, x, y): y = a*x + y */
+static int baxpy (lua_State *L) {
+  const Kernels *K = getkernels();
+  lua_Number a = luaL_checknumber(L, 1);
+  int aint = lua_isinteger(L, 1);
+  lua_Integer ia = lua_tointeger(L, 1);
+  lua_Number xbuf[CHUNK], ybuf[CHUNK];
+  lua_Integer ixbuf[CHUNK], iybuf[CHUNK];
+  lua_Integer i;
+  Vec x, y;
+  checkvec(L, 2, &x);
+  checkvec(L, 3, &y);
+  luaL_argcheck(L, x.n == y.n, 3, "sequences of different lengths");
+  for (i = 1; i <= y.n; i += CHUNK) {
+    size_t m = chunklen(&y, i);
+    lua_Integer *q, *qx;
+    if (aint && (q = getintchunk(&y, i, m, iybuf)) != NULL &&
+                (qx = getintchunk(&x, i, m, ixbuf)) != NULL) {
+      iaxpy(ia, qx, q, m);
+      putintchunk(&y, i, m, q);
+    }
+    else {
+      lua_Number *p = getchunk(&y, i, m, ybuf);
+      K->axpy(a, getchunk(&x, i, m, xbuf), p, m);
+      putchunk(&y, i, m, p);
+    }
+  }
+  lua_settop(L, 3);
+  return 1;
+}
+
+
+static int bscale (lua_State *L) {
+  const Kernels *K = getkernels();
+  lua_Number a = luaL_checknumber(L, 2);
+  int aint = lua_isinteger(L, 2);
+  lua_Integer ia = lua_tointeger(L, 2);
+  lua_Number buf[CHUNK];
+  lua_Integer ibuf[CHUNK];
+  lua_Integer i;
+  Vec v;
+  checkvec(L, 1, &v);
+  for (i = 1; i <= v.n; i += CHUNK) {
+    size_t m = chunklen(&v, i);
+    lua_Integer *q;
+    if (aint && (q = getintchunk(&v, i, m, ibuf)) != NULL) {
+      iscale(ia, q, m);
+      putintchunk(&v, i, m, q);
+    }
+    else {
+      lua_Number *p = getchunk(&v, i, m, buf);
+      K->scale(a, p, m);
+      putchunk(&v, i, m, p);
+    }
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int bclamp (lua_State *L) {
+  const Kernels *K = getkernels();
+  lua_Number lo = luaL_checknumber(L, 2);
+  lua_Number hi = luaL_checknumber(L, 3);
+  int boundsint = lua_isinteger(L, 2) && lua_isinteger(L, 3);
+  lua_Integer ilo = lua_tointeger(L, 2);
+  lua_Integer ihi = lua_tointeger(L, 3);
+  lua_Number buf[CHUNK];
+  lua_Integer ibuf[CHUNK];
+  lua_Integer i;
+  Vec v;
+  checkvec(L, 1, &v);
+  luaL_argcheck(L, lo <= hi, 3, "interval is empty");
+  for (i = 1; i <= v.n; i += CHUNK) {
+    size_t m = chunklen(&v, i);
+    lua_Integer *q;
+    if (boundsint && (q = getintchunk(&v, i, m, ibuf)) != NULL) {
+      iclamp(ilo, ihi, q, m);
+      putintchunk(&v, i, m, q);
+    }
+    else {
+      lua_Number *p = getchunk(&v, i, m, buf);
+      K->clamp(lo, hi, p, m);
+      putchunk(&v, i, m, p);
+    }
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+/* index of the (first) largest element */
+static int bargmax (lua_State *L) {
+  lua_Number buf[CHUNK];
+  lua_Number best = 0;
+  lua_Integer i, besti = 0;
+  Vec v;
+  checkvec(L, 1, &v);
+  for (i = 1; i <= v.n; i += CHUNK) {
+    size_t m = chunklen(&v, i);
+    const lua_Number *p = getchunk(&v, i, m, buf);
+    size_t k;
+    for (k = 0; k < m; k++) {
+      if (besti == 0 || p[k] > best) {
+        best = p[k];
+        besti = i + (lua_Integer)k;
+      }
+    }
+  }
+  if (besti == 0)
+    lua_pushnil(L);  /* empty sequence */
+  else
+    lua_pushinteger(L, besti);
+  return 1;
+}
+
+
+/* inclusive prefix sums, in place */
+static int bprefixsum (lua_State *L) {
+  lua_Number buf[CHUNK];
+  lua_Integer ibuf[CHUNK];
+  lua_Number s = 0;
+  lua_Integer is = 0;
+  int isint = 1;  /* all chunks so far were integers? */
+  lua_Integer i;
+  Vec v;
+  checkvec(L, 1, &v);
+  for (i = 1; i <= v.n; i += CHUNK) {
+    size_t m = chunklen(&v, i);
+    lua_Integer *q;
+    size_t k;
+    if (isint && (q = getintchunk(&v, i, m, ibuf)) != NULL) {
+      for (k = 0; k < m; k++)
+        q[k] = is = intop(+, is, q[k]);
+      putintchunk(&v, i, m, q);
+    }
+    else {
+      lua_Number *p = getchunk(&v, i, m, buf);
+      if (isint) { s = (lua_Number)is; isint = 0; }
+      for (k = 0; k < m; k++)
+        p[k] = (s += p[k]);
+      putchunk(&v, i, m, p);
+    }
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+/* ORDER mapnames */
+static lua_Number (*const mapfuncs[]) (lua_Number) = {
+  NULL, NULL, l_mathop(exp), l_mathop(log), l_mathop(floor), l_mathop(ceil),
+  l_mathop(sin), l_mathop(cos)
+};
+
+static const char *const mapnames[] =
+  {"abs", "sqrt", "exp", "log", "floor", "ceil", "sin", "cos", NULL};
+
+
+/*
+** map(v, name): apply math function 'name' to all elements, in place.
+** As 'math.abs', 'math.floor' and 'math.ceil', "abs", "floor" and
+** "ceil" keep integers as integers.
+*/
+static int bmap (lua_State *L) {
+  const Kernels *K = getkernels();
+  int op = luaL_checkoption(L, 2, NULL, mapnames);
+  int keepint = (op == 0 || op == 4 || op == 5);  /* abs, floor, ceil */
+  lua_Number buf[CHUNK];
+  lua_Integer ibuf[CHUNK];
+  lua_Integer i;
+  Vec v;
+  checkvec(L, 1, &v);
+  for (i = 1; i <= v.n; i += CHUNK) {
+    size_t m = chunklen(&v, i);
+    lua_Number *p;
+    lua_Integer *q;
+    if (keepint && (q = getintchunk(&v, i, m, ibuf)) != NULL) {
+      if (op == 0) {  /* floor and ceil do not change integers */
+        iabs(q, m);
+        putintchunk(&v, i, m, q);
+      }
+      continue;
+    }
+    p = getchunk(&v, i, m, buf);
+    if (op == 0) K->abs(p, m);
+    else if (op == 1) K->sqrt(p, m);
+    else {
+      size_t k;
+      for (k = 0; k < m; k++) p[k] = mapfuncs[op](p[k]);
+    }
+    putchunk(&v, i, m, p);
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+static int ipairsaux (lua_State *L) {
+  lua_Integer i = luaL_checkinteger(L, 2) + 1;
+  lua_pushinteger(L, i);
+  return (lua_geti(L, 1, i) == LUA_TNIL) ? 1 : 2;
+}
+
+
+/* for 'ipairs' with LUA_COMPAT_IPAIRS, which only accepts tables */
+static int aipairs (lua_State *L) {
+  checkarray(L, 1, NULL, NULL);
+  lua_pushcfunction(L, ipairsaux);
+  lua_pushvalue(L, 1);
+  lua_pushinteger(L, 0);
+  return 3;
+}
+
+
+static int newindex (lua_State *L) {
+  return luaL_error(L, "invalid key (%s) for typed array",
+                       luaL_typename(L, 2));
+}
+
+
+static int tostring (lua_State *L) {
+  int type;
+  size_t n;
+  const char *a = checkarray(L, 1, &type, &n);
+  lua_pushfstring(L, "array<%s>[%d]: %p", typenames[type - 1], (int)n, a);
+  return 1;
+}
+
+
+static const luaL_Reg array_funcs[] = {
+  {"new", anew},
+  {"type", atype},
+  {"tobytes", tobytes},
+  {"frombytes", frombytes},
+  {"totable", totable},
+  {"sum", bsum},
+  {"min", bmin},
+  {"max", bmax},
+  {"dot", bdot},
+  {"axpy", baxpy},
+  {"scale", bscale},
+  {"clamp", bclamp},
+  {"argmax", bargmax},
+  {"prefixsum", bprefixsum},
+  {"map", bmap},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg array_meta[] = {
+  {"__ipairs", aipairs},
+  {"__newindex", newindex},
+  {"__tostring", tostring},
+  {NULL, NULL}
+};
+
+
+LUAMOD_API int luaopen_array (lua_State *L) {
+  luaL_newlib(L, array_funcs);
+  luaL_newmetatable(L, ARRAYMT);
+  luaL_setfuncs(L, array_meta, 0);
+  lua_pushvalue(L, -2);
+  lua_setfield(L, -2, "__index");  /* metatable.__index = array */
+  lua_pop(L, 1);  /* pop metatable */
+  return 1;
+}
+
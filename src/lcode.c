@@ -952,3 +952,30 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+/*
+** Replace the opcode of the first instruction of some common pairs by
+** a superinstruction (see lopcodes.h). Must run only after all code of
+** the function is final, as the rest of the code generator does not
+** know about these opcodes.
+*/
+void luaK_fuse (FuncState *fs) {
+  Instruction *code = fs->f->code;
+  int pc;
+  for (pc = 0; pc + 1 < fs->pc; pc++) {
+    OpCode next = GET_OPCODE(code[pc + 1]);
+    switch (GET_OPCODE(code[pc])) {
+      case OP_GETTABUP:
+        if (next == OP_GETTABLE) SET_OPCODE(code[pc], OP_GETTABUPGT);
+        break;
+      case OP_GETUPVAL:
+        if (next == OP_GETTABLE) SET_OPCODE(code[pc], OP_GETUPVALGT);
+        break;
+      case OP_SELF:
+        if (next == OP_CALL) SET_OPCODE(code[pc], OP_SELFCALL);
+        break;
+      default: break;
+    }
+  }
+}
+
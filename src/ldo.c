@@ -60,6 +60,22 @@
 	try { a } catch(...) { if ((c)->status == 0) (c)->status = -1; }
 #define luai_jmpbuf		int  /* dummy variable */
 
+#elif defined(LUA_USE_BUILTINJMP)			/* }{ */
+
+/*
+** GCC/Clang builtins: '__builtin_setjmp' only records the frame,
+** stack pointer and resume address (the callee-saved registers are
+** spilled by the prologue of the function that calls it), and never
+** touches the signal mask. That makes entering a protected call (every
+** 'pcall') noticeably cheaper than '_setjmp'. '__builtin_longjmp' must
+** not be called from the function that did the '__builtin_setjmp',
+** which holds here: 'luaD_throw' is never inlined into
+** 'luaD_rawrunprotected'.
+*/
+#define LUAI_THROW(L,c)		__builtin_longjmp((c)->b, 1)
+#define LUAI_TRY(L,c,a)		if (__builtin_setjmp((c)->b) == 0) { a }
+typedef void *luai_jmpbuf[5];
+
 #elif defined(LUA_USE_POSIX)				/* }{ */
 
 /* in POSIX, try _longjmp/_setjmp (more efficient) */
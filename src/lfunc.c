@@ -16,6 +16,7 @@
 
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -29,6 +30,7 @@ CClosure *luaF_newCclosure (lua_State *L, int n) {
   GCObject *o = luaC_newobj(L, LUA_TCCL, sizeCclosure(n));
   CClosure *c = gco2ccl(o);
   c->nupvalues = cast_byte(n);
+  c->nflat = 0;
   return c;
 }
 
@@ -37,10 +39,19 @@ CClosure *luaF_newCclosure (lua_State *L, int n) {
  * 新建一个有 n 个 upvalues 的Lua闭包
  */
 LClosure *luaF_newLclosure (lua_State *L, int n) {
-  GCObject *o = luaC_newobj(L, LUA_TLCL, sizeLclosure(n));
+  return luaF_newLclosureflat(L, n, 0);
+}
+
+
+/*
+** new Lua closure with 'n' upvalues, with room for 'nf' flat ones
+*/
+LClosure *luaF_newLclosureflat (lua_State *L, int n, int nf) {
+  GCObject *o = luaC_newobj(L, LUA_TLCL, sizeLclosureflat(n, nf));
   LClosure *c = gco2lcl(o);
   c->p = NULL;
   c->nupvalues = cast_byte(n);
+  c->nflat = cast_byte(nf);
   while (n--) c->upvals[n] = NULL;
   return c;
 }
@@ -93,6 +104,39 @@ UpVal *luaF_findupval (lua_State *L, StkId level) {
 }
 
 
+/*
+** make the 'i'-th flat upvalue of 'cl' a closed upvalue holding a copy
+** of 'v', for a variable that is never assigned after capture: nothing
+** else can see it change, so it needs neither the list of open upvalues
+** nor closing at block exit, nor an object of its own. It goes with
+** 'cl', which holds its only reference.
+*/
+UpVal *luaF_setflatupval (lua_State *L, LClosure *cl, int i,
+                          const TValue *v) {
+  UpVal *uv = flatupvals(cl) + i;
+  lua_assert(i < cl->nflat);
+  uv->refcount = 1;
+  uv->v = &uv->u.value;  /* make it closed */
+  setobj(L, uv->v, v);
+  return uv;
+}
+
+
+/*
+** move the flat upvalue 'cl->upvals[i]' out to an upvalue of its own,
+** so that it can be shared with other closures
+*/
+UpVal *luaF_unflatupval (lua_State *L, LClosure *cl, int i) {
+  UpVal *uv = luaM_new(L, UpVal);
+  lua_assert(isflatupval(cl, cl->upvals[i]));
+  uv->refcount = 1;
+  uv->v = &uv->u.value;  /* make it closed */
+  setobj(L, uv->v, cl->upvals[i]->v);
+  cl->upvals[i] = uv;
+  return uv;
+}
+
+
 /**
  * 关闭栈 level 位置以上(包括level)的 upvalue, upvalue 引用为0则释放该对象 
  */
@@ -126,6 +170,8 @@ Proto *luaF_newproto (lua_State *L) {
   f->sizep = 0;
   f->code = NULL;
   f->cache = NULL;
+  f->jit = NULL;
+  f->jithot = LUAI_JITHOT;
   f->sizecode = 0;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
@@ -145,6 +191,7 @@ Proto *luaF_newproto (lua_State *L) {
 
 /* 释放Proto分配的内存 */
 void luaF_freeproto (lua_State *L, Proto *f) {
+  luaJ_free(L, f);
   luaM_freearray(L, f->code, f->sizecode);
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
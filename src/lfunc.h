@@ -23,6 +23,23 @@
 #define sizeLclosure(n)	(cast(int, sizeof(LClosure)) + \
                          cast(int, sizeof(TValue *)*((n)-1)))
 
+/*
+** A Lua closure keeps the upvalues for captured variables that are
+** never assigned ("flat" upvalues) inside itself, after 'upvals'
+** (rounded up to the maximum alignment, for the 'TValue's in them).
+*/
+#define flatoffset(n)  \
+	((sizeLclosure(n) + cast(int, sizeof(L_Umaxalign)) - 1) / \
+	  cast(int, sizeof(L_Umaxalign)) * cast(int, sizeof(L_Umaxalign)))
+#define sizeLclosureflat(n,nf)	(flatoffset(n) + \
+                                 cast(int, sizeof(UpVal)*(nf)))
+#define flatupvals(cl)	cast(UpVal *, cast(char *, cl) + \
+                                      flatoffset((cl)->nupvalues))
+
+/* test whether 'uv' is one of the flat upvalues of closure 'cl' */
+#define isflatupval(cl,uv)	((cl)->nflat > 0 && flatupvals(cl) <= (uv) && \
+                                 (uv) < flatupvals(cl) + (cl)->nflat)
+
 
 /* test whether thread is in 'twups' list */
 #define isintwups(L)	(L->twups != L)
@@ -63,8 +80,13 @@ LUAI_FUNC Proto *luaF_newproto (lua_State *L);
  */
 LUAI_FUNC CClosure *luaF_newCclosure (lua_State *L, int nelems);
 LUAI_FUNC LClosure *luaF_newLclosure (lua_State *L, int nelems);
+LUAI_FUNC LClosure *luaF_newLclosureflat (lua_State *L, int nelems,
+                                          int nflat);
 LUAI_FUNC void luaF_initupvals (lua_State *L, LClosure *cl);
 LUAI_FUNC UpVal *luaF_findupval (lua_State *L, StkId level);
+LUAI_FUNC UpVal *luaF_setflatupval (lua_State *L, LClosure *cl, int i,
+                                      const TValue *v);
+LUAI_FUNC UpVal *luaF_unflatupval (lua_State *L, LClosure *cl, int i);
 LUAI_FUNC void luaF_close (lua_State *L, StkId level);
 LUAI_FUNC void luaF_freeproto (lua_State *L, Proto *f);
 /*
@@ -652,7 +652,7 @@ static lu_mem traverseLclosure (global_State *g, LClosure *cl) {
         markvalue(g, uv->v);
     }
   }
-  return sizeLclosure(cl->nupvalues);
+  return sizeLclosureflat(cl->nupvalues, cl->nflat);
 }
 
 
@@ -839,10 +839,10 @@ static void freeLclosure (lua_State *L, LClosure *cl) {
   int i;
   for (i = 0; i < cl->nupvalues; i++) {
     UpVal *uv = cl->upvals[i];
-    if (uv)
+    if (uv && !isflatupval(cl, uv))  /* (flat ones go with 'cl') */
       luaC_upvdeccount(L, uv);
   }
-  luaM_freemem(L, cl, sizeLclosure(cl->nupvalues));
+  luaM_freemem(L, cl, sizeLclosureflat(cl->nupvalues, cl->nflat));
 }
 
 
@@ -865,7 +865,13 @@ static void freeobj (lua_State *L, GCObject *o) {
       luaS_remove(L, gco2ts(o));  /* remove it from hash table */
       /* go through */
     case LUA_TLNGSTR: {
-      luaM_freemem(L, o, sizestring(gco2ts(o)));
+      TString *ts = gco2ts(o);
+      if (ts->isext) {  /* external string? */
+        ExtString *e = getextstr(ts);
+        if (e->release != NULL)
+          e->release(e->ud, e->contents, ts->len);  /* release contents */
+      }
+      luaM_freemem(L, o, sizestring(ts));
       break;
     }
     default: lua_assert(0);
@@ -13,6 +13,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <locale.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -88,6 +89,20 @@
 #endif				/* } */
 
 
+/*
+** l_bufdata(f,n) gives the characters of file 'f' already in its stdio
+** buffer (setting 'n' to how many there are), and l_bufskip(f,n) consumes
+** 'n' of them. With them, 'read_line' looks for the newline with 'memchr'
+** and copies whole spans; otherwise it reads one character at a time.
+*/
+#if !defined(l_bufdata) && defined(LUA_USE_POSIX) && defined(__GLIBC__)
+#define l_bufdata(f,n)  \
+	((n) = (size_t)((f)->_IO_read_end - (f)->_IO_read_ptr), \
+	 (const char *)(f)->_IO_read_ptr)
+#define l_bufskip(f,n)		((f)->_IO_read_ptr += (n))
+#endif
+
+
 /*
 ** {======================================================
 ** l_fseek: configuration for longer offsets
@@ -126,6 +141,71 @@
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** l_mmap maps a whole regular file in memory, read only.
+** =======================================================
+*/
+
+#if !defined(l_mmap)		/* { */
+
+#if defined(LUA_USE_POSIX)	/* { */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+** Map file descriptor 'fd' if it is a regular file with at least 'min'
+** bytes, setting '*sz' to its size; return NULL otherwise. The file is
+** mapped over zeroed memory one byte longer, so that its contents are
+** always followed by a '\0', even when it fills its last page.
+*/
+static char *mapfd (int fd, size_t *sz, size_t min) {
+  static char empty[1];
+  struct stat st;
+  void *p;
+  if (fstat(fd, &st) != 0)
+    return NULL;
+  if (!S_ISREG(st.st_mode)) {
+    errno = ENODEV;
+    return NULL;
+  }
+  if ((lua_Unsigned)(size_t)st.st_size != (lua_Unsigned)st.st_size) {
+    errno = EFBIG;  /* does not fit in memory */
+    return NULL;
+  }
+  if ((lua_Unsigned)st.st_size < min)
+    return NULL;
+  *sz = (size_t)st.st_size;
+  if (*sz == 0)
+    return empty;  /* cannot map an empty file */
+  if (*sz == (size_t)-1) {
+    errno = EFBIG;  /* no room for the final '\0' */
+    return NULL;
+  }
+  p = mmap(NULL, *sz + 1, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    return NULL;
+  if (mmap(p, *sz, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    int en = errno;
+    munmap(p, *sz + 1);
+    errno = en;
+    return NULL;
+  }
+  return (char *)p;
+}
+
+#define l_mmap(fd,sz,min)	mapfd(fd,sz,min)
+#define l_munmap(p,sz)		((sz) > 0 ? (void)munmap(p, (sz) + 1) : (void)0)
+#define l_fileno(f)		fileno(f)
+
+#endif				/* } */
+
+#endif				/* } */
+
+/* }====================================================== */
+
+
 #define IO_PREFIX	"_IO_"
 #define IOPREF_LEN	(sizeof(IO_PREFIX)/sizeof(char) - 1)
 #define IO_INPUT	(IO_PREFIX "input")
@@ -446,6 +526,159 @@ static int io_lines (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** Memory-mapped files
+** =======================================================
+*/
+
+#define LUA_MAPHANDLE	"MAP*"
+
+
+typedef struct LMap {
+  char *p;  /* mapped memory */
+  size_t size;
+  int closed;
+} LMap;
+
+
+#define tolmap(L)	((LMap *)luaL_checkudata(L, 1, LUA_MAPHANDLE))
+
+
+/* as with files, create a closed mapping before mapping the file */
+static LMap *newmap (lua_State *L) {
+  LMap *m = (LMap *)lua_newuserdata(L, sizeof(LMap));
+  m->p = NULL;
+  m->size = 0;
+  m->closed = 1;
+  luaL_setmetatable(L, LUA_MAPHANDLE);
+  return m;
+}
+
+
+static void closemap (LMap *m) {
+#if defined(l_mmap)
+  if (!m->closed)
+    l_munmap(m->p, m->size);
+#endif
+  m->closed = 1;
+}
+
+
+static LMap *tomap (lua_State *L) {
+  LMap *m = tolmap(L);
+  if (m->closed)
+    luaL_error(L, "attempt to use a closed mapping");
+  return m;
+}
+
+
+/*
+** io.mmap(filename) maps a file read only; slices of it are taken with
+** 'm:sub' (as in 'string.sub'), or all of it with 'm:string'. The
+** mapping is released by 'm:close' or when 'm' is collected. As with
+** any mapping, truncating the file while it is in use raises SIGBUS.
+*/
+static int io_mmap (lua_State *L) {
+  const char *filename = luaL_checkstring(L, 1);
+#if defined(l_mmap)
+  LMap *m = newmap(L);
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL)
+    return luaL_fileresult(L, 0, filename);
+  m->p = l_mmap(l_fileno(f), &m->size, 0);
+  if (m->p == NULL) {
+    int en = errno;
+    fclose(f);
+    errno = en;
+    return luaL_fileresult(L, 0, filename);
+  }
+  fclose(f);
+  m->closed = 0;
+  return 1;
+#else
+  return luaL_error(L, "'mmap' not supported (%s)", filename);
+#endif
+}
+
+
+static int m_len (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)tomap(L)->size);
+  return 1;
+}
+
+
+/* translate a relative string position (as in 'string.sub') */
+static size_t posrelat (lua_Integer pos, size_t len) {
+  if (pos >= 0) return (size_t)pos;
+  else if (0u - (size_t)pos > len) return 0;
+  else return len - ((size_t)-pos) + 1;
+}
+
+
+static int m_sub (lua_State *L) {
+  LMap *m = tomap(L);
+  size_t l = m->size;
+  size_t start = posrelat(luaL_checkinteger(L, 2), l);
+  size_t end = posrelat(luaL_optinteger(L, 3, -1), l);
+  if (start < 1) start = 1;
+  if (end > l) end = l;
+  if (start <= end)
+    lua_pushlstring(L, m->p + start - 1, (end - start) + 1);
+  else lua_pushliteral(L, "");
+  return 1;
+}
+
+
+/* release the contents of a string made by 'm_string' */
+static void unmapstr (void *ud, const char *s, size_t len) {
+  (void)ud;
+#if defined(l_mmap)
+  l_munmap((char *)s, len);
+#else
+  (void)s; (void)len;
+#endif
+}
+
+
+/*
+** m:string() gives the whole mapping as a string, without copying it.
+** The string owns the mapping from then on (it is unmapped when the
+** string is collected) and 'm' is closed. As with any mapping, the
+** file should not change while the string is in use.
+*/
+static int m_string (lua_State *L) {
+  LMap *m = tomap(L);
+  lua_pushexternalstring(L, m->p, m->size, unmapstr, NULL);
+  m->closed = 1;  /* only now, as pushing may raise a memory error */
+  return 1;
+}
+
+
+static int m_close (lua_State *L) {
+  closemap(tomap(L));
+  return 0;
+}
+
+
+static int m_gc (lua_State *L) {
+  closemap(tolmap(L));
+  return 0;
+}
+
+
+static int m_tostring (lua_State *L) {
+  LMap *m = tolmap(L);
+  if (m->closed)
+    lua_pushliteral(L, "mapping (closed)");
+  else
+    lua_pushfstring(L, "mapping (%p)", m->p);
+  return 1;
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** READ
@@ -554,6 +787,52 @@ static int test_eof (lua_State *L, FILE *f) {
 }
 
 
+/*
+** Read into 'buff' at most LUAL_BUFFERSIZE characters of the current
+** line, without its newline. '*c' gets the character that stopped the
+** reading: '\n', EOF, or something else if 'buff' got full. The file
+** must be locked.
+*/
+static int read_linepart (FILE *f, char *buff, int *c) {
+  int i = 0;
+#if defined(l_bufdata)
+  for (;;) {
+    size_t n;
+    const char *p = l_bufdata(f, n);
+    if (n > 0) {
+      const char *nl;
+      if (n > (size_t)(LUAL_BUFFERSIZE - i))
+        n = LUAL_BUFFERSIZE - i;
+      nl = (const char *)memchr(p, '\n', n);
+      if (nl != NULL) {  /* end of line in the buffer? */
+        memcpy(buff + i, p, nl - p);
+        l_bufskip(f, (nl - p) + 1);
+        *c = '\n';
+        return i + (int)(nl - p);
+      }
+      memcpy(buff + i, p, n);
+      l_bufskip(f, n);
+      i += (int)n;
+      if (i == LUAL_BUFFERSIZE) {
+        *c = '\0';  /* line goes on */
+        return i;
+      }
+    }
+    /* stdio buffer is empty; 'l_getc' refills it */
+    if ((*c = l_getc(f)) == EOF || *c == '\n')
+      return i;
+    buff[i++] = *c;
+    if (i == LUAL_BUFFERSIZE)
+      return i;
+  }
+#else
+  while (i < LUAL_BUFFERSIZE && (*c = l_getc(f)) != EOF && *c != '\n')
+    buff[i++] = *c;
+  return i;
+#endif
+}
+
+
 /**
  * chop: 是否不读入 '\n'
  * 读入至少一个字符则返回 true，否则返回false
@@ -565,10 +844,9 @@ static int read_line (lua_State *L, FILE *f, int chop) {
   luaL_buffinit(L, &b);
   while (c != EOF && c != '\n') {  /* repeat until end of line */
     char *buff = luaL_prepbuffer(&b);  /* pre-allocate buffer */
-    int i = 0;
+    int i;
     l_lockfile(f);  /* no memory errors can happen inside the lock */
-    while (i < LUAL_BUFFERSIZE && (c = l_getc(f)) != EOF && c != '\n')
-      buff[i++] = c;
+    i = read_linepart(f, buff, &c);
     l_unlockfile(f);
     luaL_addsize(&b, i);
   }
@@ -580,12 +858,59 @@ static int read_line (lua_State *L, FILE *f, int chop) {
 }
 
 
+/*
+** LUA_USE_MMAPREAD makes 'read("a")' read large regular files by
+** mapping them. It is off by default: if another process truncates the
+** file while it is being copied, the process gets SIGBUS instead of a
+** short read.
+*/
+#if defined(l_mmap) && defined(LUA_USE_MMAPREAD)
+
+/* rest of files at least this large is read by mapping them */
+#define MAPMIN		(1 << 16)
+
+/*
+** Read the rest of a regular file by mapping it, so that its contents
+** are copied only once, straight into the result string, with no
+** buffer as large as the string besides it. (The mapping is kept in
+** a LMap, so that a memory error does not leak it.)
+*/
+static int read_mapped (lua_State *L, FILE *f) {
+  LMap *m;
+  l_seeknum pos;
+  if (fflush(f) != 0 || (pos = l_ftell(f)) < 0)
+    return 0;
+  m = newmap(L);
+  m->p = l_mmap(l_fileno(f), &m->size, MAPMIN);
+  if (m->p == NULL || m->size - MAPMIN < (size_t)pos) {  /* too small? */
+    if (m->p != NULL) {
+      m->closed = 0;
+      closemap(m);
+    }
+    lua_pop(L, 1);
+    return 0;
+  }
+  m->closed = 0;
+  lua_pushlstring(L, m->p + pos, m->size - (size_t)pos);
+  l_fseek(f, (l_seeknum)m->size, SEEK_SET);
+  closemap(m);
+  lua_remove(L, -2);  /* remove mapping */
+  return 1;
+}
+
+#endif
+
+
 /**
  * 读入文件全部内容, 结果存放在栈顶
  */
 static void read_all (lua_State *L, FILE *f) {
   size_t nr;
   luaL_Buffer b;
+#if defined(l_mmap) && defined(LUA_USE_MMAPREAD)
+  if (read_mapped(L, f))
+    return;
+#endif
   luaL_buffinit(L, &b);
   do {  /* read file in chunks of LUAL_BUFFERSIZE bytes */
     char *p = luaL_prepbuffsize(&b, LUAL_BUFFERSIZE);
@@ -727,6 +1052,10 @@ static int io_readline (lua_State *L) {
 
 /* }====================================================== */
 
+/* maximum length of a number written by 'g_write' */
+#define MAXNUMBER2STR	50
+
+
 /*
  * Writes the value of each of its arguments to file. The arguments 
  * must be strings or numbers.
@@ -737,23 +1066,49 @@ static int io_readline (lua_State *L) {
 /**
  * arg: 类似 g_read 的 first 参数
  */
+/*
+** Write all arguments to 'f' with as few 'fwrite' calls as possible:
+** numbers and small strings are gathered in 'buff', so that a whole
+** call usually takes the lock of 'f' only once. (Values that are not
+** strings raise an error only after the values before them have been
+** written, as always.)
+*/
 static int g_write (lua_State *L, FILE *f, int arg) {
+  char buff[LUAL_BUFFERSIZE];
+  size_t n = 0;  /* number of chars in 'buff' */
   int nargs = lua_gettop(L) - arg;
   int status = 1;
   for (; nargs--; arg++) {
     if (lua_type(L, arg) == LUA_TNUMBER) {
-      /* optimization: could be done exactly as for strings */
-      int len = lua_isinteger(L, arg)
-                ? fprintf(f, LUA_INTEGER_FMT, lua_tointeger(L, arg))
-                : fprintf(f, LUA_NUMBER_FMT, lua_tonumber(L, arg));
-      status = status && (len > 0);
+      if (LUAL_BUFFERSIZE - n < MAXNUMBER2STR) {  /* no room? */
+        status = status && (fwrite(buff, sizeof(char), n, f) == n);
+        n = 0;
+      }
+      if (lua_isinteger(L, arg))
+        n += lua_integer2buff(buff + n, lua_tointeger(L, arg));
+      else {
+        lua_Number x = lua_tonumber(L, arg);
+        int len = lua_number2buff(buff + n, x);
+        n += (len > 0) ? len : lua_number2str(buff + n, x);
+      }
     }
     else {
       size_t l;
-      const char *s = luaL_checklstring(L, arg, &l);
-      status = status && (fwrite(s, sizeof(char), l, f) == l);
+      const char *s;
+      if (!lua_isstring(L, arg) || LUAL_BUFFERSIZE - n < lua_rawlen(L, arg)) {
+        status = status && (fwrite(buff, sizeof(char), n, f) == n);
+        n = 0;
+      }
+      s = luaL_checklstring(L, arg, &l);
+      if (l >= LUAL_BUFFERSIZE)  /* large string? */
+        status = status && (fwrite(s, sizeof(char), l, f) == l);
+      else {
+        memcpy(buff + n, s, l);
+        n += l;
+      }
     }
   }
+  status = status && (fwrite(buff, sizeof(char), n, f) == n);
   if (status) return 1;  /* file handle already on stack top */
   else return luaL_fileresult(L, status, NULL);
 }
@@ -801,6 +1156,25 @@ static int f_setvbuf (lua_State *L) {
 }
 
 
+/* default size of the buffer set by 'writebuffer' */
+#define WRITEBUFSIZE	(1 << 16)
+
+/*
+** file:writebuffer([size]) makes the file fully buffered with a buffer
+** of 'size' bytes, so that many small writes (e.g., to a terminal,
+** which is line buffered) become a few large ones. It is the same as
+** file:setvbuf("full", size), with a larger default size.
+*/
+static int f_writebuffer (lua_State *L) {
+  FILE *f = tofile(L);
+  lua_Integer sz = luaL_optinteger(L, 2, WRITEBUFSIZE);
+  luaL_argcheck(L, sz > 0, 2, "invalid size");
+  if (setvbuf(f, NULL, _IOFBF, (size_t)sz) != 0)
+    return luaL_fileresult(L, 0, NULL);
+  lua_settop(L, 1);
+  return 1;  /* return file */
+}
+
 
 static int io_flush (lua_State *L) {
   return luaL_fileresult(L, fflush(getiofile(L, IO_OUTPUT)) == 0, NULL);
@@ -820,6 +1194,7 @@ static const luaL_Reg iolib[] = {
   {"flush", io_flush},
   {"input", io_input},
   {"lines", io_lines},
+  {"mmap", io_mmap},
   {"open", io_open},
   {"output", io_output},
   {"popen", io_popen},
@@ -842,18 +1217,38 @@ static const luaL_Reg flib[] = {
   {"seek", f_seek},
   {"setvbuf", f_setvbuf},
   {"write", f_write},
+  {"writebuffer", f_writebuffer},
   {"__gc", f_gc},
   {"__tostring", f_tostring},
   {NULL, NULL}
 };
 
 
+/*
+** methods for mappings
+*/
+static const luaL_Reg mlib[] = {
+  {"close", m_close},
+  {"string", m_string},
+  {"sub", m_sub},
+  {"__gc", m_gc},
+  {"__len", m_len},
+  {"__tostring", m_tostring},
+  {NULL, NULL}
+};
+
+
 static void createmeta (lua_State *L) {
   luaL_newmetatable(L, LUA_FILEHANDLE);  /* create metatable for file handles */
   lua_pushvalue(L, -1);  /* push metatable */
   lua_setfield(L, -2, "__index");  /* metatable.__index = metatable */
   luaL_setfuncs(L, flib, 0);  /* add file methods to new metatable */
   lua_pop(L, 1);  /* pop new metatable */
+  luaL_newmetatable(L, LUA_MAPHANDLE);  /* same for mappings */
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  luaL_setfuncs(L, mlib, 0);
+  lua_pop(L, 1);
 }
 
 
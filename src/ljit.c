@@ -0,0 +1,881 @@
+/*
+** $Id: ljit.c $
+** Baseline compiler from Lua bytecode to x86-64 machine code
+** See Copyright Notice in lua.h
+*/
+
+#define ljit_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include "lua.h"
+
+#include "ljit.h"
+
+#if defined(LUA_USE_JIT)
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "lfunc.h"
+#include "lgc.h"
+#include "lopcodes.h"
+
+
+/*
+** Each instruction of a hot prototype is translated by a fixed template
+** that works directly on the TValues of the Lua stack, so the state of
+** the compiled code is always the state of the interpreter. Templates
+** only cover the fast cases (numbers, array parts, registers); anything
+** else, including whole opcodes without a template, "exits": the code
+** returns the pc of the instruction to the interpreter, which executes
+** it and goes on. Compiled code never calls back into Lua, never
+** allocates and never raises errors. Backward jumps check 'hookmask'
+** and exit when a hook was set (e.g., by a signal handler), so hooks
+** always see the interpreter.
+*/
+
+
+/* compiled code of a prototype; the mapping also holds the code */
+typedef struct JitCode {
+  size_t size;  /* size of the whole mapping */
+  lu_byte *code;  /* machine code */
+  int pcoff[1];  /* offset in 'code' of each instruction */
+} JitCode;
+
+
+/* signature of the compiled code: it returns the pc to resume at */
+typedef int (*JitFunction) (StkId base, TValue *k, lu_byte *hookmask,
+                            UpVal **upvals, const lu_byte *entry);
+
+
+/* larger prototypes are left to the interpreter */
+#define MAXJITCODE	(1 << 16)
+
+/* maximum number of exits from one template */
+#define MAXEXITS	16
+
+
+/* x86-64 registers */
+#define RAX	0
+#define RCX	1
+#define RDX	2
+#define RBX	3	/* 'base' */
+#define R8	8
+#define R12	12	/* 'k' */
+#define R13	13	/* 'hookmask' */
+#define R14	14	/* 'upvals' */
+
+/* condition codes */
+#define CC_ALWAYS	(-1)
+#define CC_B	0x2
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_A	0x7
+#define CC_P	0xA
+#define CC_L	0xC
+#define CC_LE	0xE
+
+#define TAGOFF	cast_int(offsetof(TValue, tt_))
+
+
+typedef struct JitState {
+  lu_byte *buff;  /* where to write code (NULL when only measuring) */
+  int *pcoff;  /* where to record instruction offsets (or NULL) */
+  int n;  /* size of code emitted so far */
+  int epilogue;  /* offset of the common exit sequence */
+  int pc;  /* instruction being compiled */
+  int exits[MAXEXITS];  /* pending jumps to the exit of this template */
+  int nexits;
+} JitState;
+
+
+/* a memory operand '[base + disp]' */
+typedef struct Opnd {
+  int base;
+  int disp;
+} Opnd;
+
+
+static Opnd opR (int r) {
+  Opnd o;
+  o.base = RBX;
+  o.disp = r * cast_int(sizeof(TValue));
+  return o;
+}
+
+
+static Opnd opK (int k) {
+  Opnd o;
+  o.base = R12;
+  o.disp = k * cast_int(sizeof(TValue));
+  return o;
+}
+
+
+static Opnd opRK (int x) {
+  return ISK(x) ? opK(INDEXK(x)) : opR(x);
+}
+
+
+static Opnd opat (int base, int disp) {
+  Opnd o;
+  o.base = base;
+  o.disp = disp;
+  return o;
+}
+
+
+/*
+** {======================================================
+** Assembler
+** =======================================================
+*/
+
+static void e8 (JitState *J, int b) {
+  if (J->buff) J->buff[J->n] = cast(lu_byte, b);
+  J->n++;
+}
+
+
+static void e32 (JitState *J, int v) {
+  unsigned int u = cast(unsigned int, v);
+  e8(J, u & 0xFF); e8(J, (u >> 8) & 0xFF);
+  e8(J, (u >> 16) & 0xFF); e8(J, u >> 24);
+}
+
+
+static void put32 (JitState *J, int pos, int v) {
+  if (J->buff) {
+    unsigned int u = cast(unsigned int, v);
+    J->buff[pos] = u & 0xFF; J->buff[pos + 1] = (u >> 8) & 0xFF;
+    J->buff[pos + 2] = (u >> 16) & 0xFF; J->buff[pos + 3] = u >> 24;
+  }
+}
+
+
+/*
+** emit 'op' (one byte or 0x0F plus one byte) with optional mandatory
+** prefix 'pfx' and 64-bit operand size 'w', plus a ModRM for register
+** 'reg' (or opcode extension) and operand '[base + disp32]'
+*/
+static void emitmem (JitState *J, int pfx, int w, int op, int reg, Opnd o) {
+  int rex = (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((o.base & 8) ? 1 : 0);
+  if (pfx) e8(J, pfx);
+  if (rex) e8(J, 0x40 | rex);
+  if (op > 0xFF) e8(J, op >> 8);
+  e8(J, op & 0xFF);
+  e8(J, 0x80 | ((reg & 7) << 3) | (o.base & 7));
+  if ((o.base & 7) == 4) e8(J, 0x24);  /* SIB byte for r12 */
+  e32(J, o.disp);
+}
+
+
+/* same as 'emitmem' with a register operand 'rm' */
+static void emitreg (JitState *J, int pfx, int w, int op, int reg, int rm) {
+  int rex = (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+  if (pfx) e8(J, pfx);
+  if (rex) e8(J, 0x40 | rex);
+  if (op > 0xFF) e8(J, op >> 8);
+  e8(J, op & 0xFF);
+  e8(J, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+
+static Opnd off (Opnd o, int delta) {
+  o.disp += delta;
+  return o;
+}
+
+
+/* mov reg, qword [o] */
+static void ld64 (JitState *J, int reg, Opnd o) {
+  emitmem(J, 0, 1, 0x8B, reg, o);
+}
+
+/* mov qword [o], reg */
+static void st64 (JitState *J, Opnd o, int reg) {
+  emitmem(J, 0, 1, 0x89, reg, o);
+}
+
+/* mov reg32, dword [o] */
+static void ld32 (JitState *J, int reg, Opnd o) {
+  emitmem(J, 0, 0, 0x8B, reg, o);
+}
+
+/* mov dword [o], imm32 */
+static void st32imm (JitState *J, Opnd o, int imm) {
+  emitmem(J, 0, 0, 0xC7, 0, o);
+  e32(J, imm);
+}
+
+/* cmp dword [o], imm32 */
+static void cmp32imm (JitState *J, Opnd o, int imm) {
+  emitmem(J, 0, 0, 0x81, 7, o);
+  e32(J, imm);
+}
+
+/* cmp reg32, imm32 */
+static void cmpregimm (JitState *J, int reg, int imm) {
+  emitreg(J, 0, 0, 0x81, 7, reg);
+  e32(J, imm);
+}
+
+/* movsd xmm, qword [o] */
+static void ldsd (JitState *J, int x, Opnd o) {
+  emitmem(J, 0xF2, 0, 0x0F10, x, o);
+}
+
+/* movsd qword [o], xmm */
+static void stsd (JitState *J, Opnd o, int x) {
+  emitmem(J, 0xF2, 0, 0x0F11, x, o);
+}
+
+
+static void settag (JitState *J, Opnd o, int tag) {
+  st32imm(J, off(o, TAGOFF), tag);
+}
+
+
+static void cmptag (JitState *J, Opnd o, int tag) {
+  cmp32imm(J, off(o, TAGOFF), tag);
+}
+
+
+/* copy a whole TValue (using rcx and rdx) */
+static void copyval (JitState *J, Opnd to, Opnd from) {
+  ld64(J, RCX, from);
+  ld64(J, RDX, off(from, 8));
+  st64(J, to, RCX);
+  st64(J, off(to, 8), RDX);
+}
+
+
+/* forward jump to be patched later; returns position of its offset */
+static int jfwd (JitState *J, int cc) {
+  if (cc == CC_ALWAYS) e8(J, 0xE9);
+  else { e8(J, 0x0F); e8(J, 0x80 + cc); }
+  e32(J, 0);
+  return J->n - 4;
+}
+
+
+/* make a forward jump land here */
+static void patch (JitState *J, int pos) {
+  put32(J, pos, J->n - (pos + 4));
+}
+
+
+/* jump to a known code offset */
+static void jto (JitState *J, int cc, int target) {
+  int len = (cc == CC_ALWAYS) ? 5 : 6;
+  int rel = target - (J->n + len);
+  if (cc == CC_ALWAYS) e8(J, 0xE9);
+  else { e8(J, 0x0F); e8(J, 0x80 + cc); }
+  e32(J, rel);
+}
+
+
+/* return 'pc' to the interpreter */
+static void exitto (JitState *J, int pc) {
+  e8(J, 0xB8); e32(J, pc);  /* mov eax, pc */
+  jto(J, CC_ALWAYS, J->epilogue);
+}
+
+
+/* leave the template (to its exit) when condition 'cc' holds */
+static void guard (JitState *J, int cc) {
+  lua_assert(J->nexits < MAXEXITS);
+  J->exits[J->nexits++] = jfwd(J, cc);
+}
+
+
+/*
+** jump (when 'cc' holds) to the code of instruction 'target'. Backward
+** jumps first check for hooks, leaving to the interpreter if any.
+*/
+static void jtopc (JitState *J, int cc, int target) {
+  int dest = (J->pcoff != NULL) ? J->pcoff[target] : 0;
+  if (target > J->pc)
+    jto(J, cc, dest);
+  else {
+    int skip = (cc == CC_ALWAYS) ? -1 : jfwd(J, cc ^ 1);
+    emitmem(J, 0, 0, 0x80, 7, opat(R13, 0));  /* cmp byte [hookmask], 0 */
+    e8(J, 0);
+    jto(J, CC_E, dest);
+    exitto(J, target);
+    if (skip >= 0) patch(J, skip);
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Templates
+** =======================================================
+*/
+
+/* load number 'o' into 'x' as a float */
+static void tofloat (JitState *J, int x, Opnd o) {
+  int notflt, done;
+  cmptag(J, o, LUA_TNUMFLT);
+  notflt = jfwd(J, CC_NE);
+  ldsd(J, x, o);
+  done = jfwd(J, CC_ALWAYS);
+  patch(J, notflt);
+  cmptag(J, o, LUA_TNUMINT);
+  guard(J, CC_NE);
+  emitmem(J, 0xF2, 1, 0x0F2A, x, o);  /* cvtsi2sd x, qword [o] */
+  patch(J, done);
+}
+
+
+/* R(A) := RK(B) op RK(C), for op in +, -, *, / */
+static void arith (JitState *J, OpCode op, Opnd ra, Opnd rb, Opnd rc) {
+  int sdop = (op == OP_ADD) ? 0x0F58 : (op == OP_SUB) ? 0x0F5C :
+             (op == OP_MUL) ? 0x0F59 : 0x0F5E;
+  int done = -1;
+  if (op != OP_DIV) {  /* integer case */
+    int f1, f2;
+    cmptag(J, rb, LUA_TNUMINT);
+    f1 = jfwd(J, CC_NE);
+    cmptag(J, rc, LUA_TNUMINT);
+    f2 = jfwd(J, CC_NE);
+    ld64(J, RAX, rb);
+    switch (op) {
+      case OP_ADD: emitmem(J, 0, 1, 0x03, RAX, rc); break;  /* add */
+      case OP_SUB: emitmem(J, 0, 1, 0x2B, RAX, rc); break;  /* sub */
+      default: emitmem(J, 0, 1, 0x0FAF, RAX, rc); break;  /* imul */
+    }
+    st64(J, ra, RAX);
+    settag(J, ra, LUA_TNUMINT);
+    done = jfwd(J, CC_ALWAYS);
+    patch(J, f1);
+    patch(J, f2);
+  }
+  tofloat(J, 0, rb);
+  tofloat(J, 1, rc);
+  emitreg(J, 0xF2, 0, sdop, 0, 1);  /* op xmm0, xmm1 */
+  stsd(J, ra, 0);
+  settag(J, ra, LUA_TNUMFLT);
+  if (done >= 0) patch(J, done);
+}
+
+
+static void unm (JitState *J, Opnd ra, Opnd rb) {
+  int notint, done;
+  cmptag(J, rb, LUA_TNUMINT);
+  notint = jfwd(J, CC_NE);
+  ld64(J, RAX, rb);
+  emitreg(J, 0, 1, 0xF7, 3, RAX);  /* neg rax */
+  st64(J, ra, RAX);
+  settag(J, ra, LUA_TNUMINT);
+  done = jfwd(J, CC_ALWAYS);
+  patch(J, notint);
+  cmptag(J, rb, LUA_TNUMFLT);
+  guard(J, CC_NE);
+  ld64(J, RAX, rb);
+  emitreg(J, 0, 1, 0x0FBA, 7, RAX); e8(J, 63);  /* btc rax, 63 */
+  st64(J, ra, RAX);
+  settag(J, ra, LUA_TNUMFLT);
+  patch(J, done);
+}
+
+
+/*
+** test whether 'o' is false or nil: execution falls through when it is
+** not; '*f1' and '*f2' get the jumps taken when it is
+*/
+static void testfalse (JitState *J, Opnd o, int *f1, int *f2) {
+  int notbool;
+  ld32(J, RAX, off(o, TAGOFF));
+  emitreg(J, 0, 0, 0x85, RAX, RAX);  /* test eax, eax */
+  *f1 = jfwd(J, CC_E);  /* nil */
+  cmpregimm(J, RAX, LUA_TBOOLEAN);
+  notbool = jfwd(J, CC_NE);
+  cmp32imm(J, o, 0);
+  *f2 = jfwd(J, CC_E);  /* false */
+  patch(J, notbool);
+}
+
+
+static void opnot (JitState *J, Opnd ra, Opnd rb) {
+  int f1, f2, done;
+  testfalse(J, rb, &f1, &f2);
+  st32imm(J, ra, 0);
+  done = jfwd(J, CC_ALWAYS);
+  patch(J, f1);
+  patch(J, f2);
+  st32imm(J, ra, 1);
+  patch(J, done);
+  settag(J, ra, LUA_TBOOLEAN);
+}
+
+
+/*
+** conditional jump of a test followed by its OP_JMP: code falls through
+** when the condition is true; jumps in 'f' are taken when it is false
+*/
+static void condjump (JitState *J, int *f, int nf, int a, int jtarget) {
+  int pc = J->pc, i;
+  jtopc(J, CC_ALWAYS, a ? jtarget : pc + 2);
+  for (i = 0; i < nf; i++) patch(J, f[i]);
+  jtopc(J, CC_ALWAYS, a ? pc + 2 : jtarget);
+}
+
+
+/* if ((RK(B) == RK(C)) ~= A) then pc++ */
+static void opeq (JitState *J, Opnd rb, Opnd rc, int a, int jtarget) {
+  static const int simple[] = {LUA_TNIL, LUA_TBOOLEAN, ctb(LUA_TSHRSTR),
+                               LUA_TLIGHTUSERDATA, LUA_TLCF};
+  int eq[12], ne[12], neq = 0, nne = 0;
+  int diff, isint, isflt, is32, is64[3];
+  int i;
+  ld32(J, RAX, off(rb, TAGOFF));
+  ld32(J, RCX, off(rc, TAGOFF));
+  emitreg(J, 0, 0, 0x3B, RAX, RCX);  /* cmp eax, ecx */
+  diff = jfwd(J, CC_NE);
+  cmpregimm(J, RAX, LUA_TNUMINT);
+  isint = jfwd(J, CC_E);
+  cmpregimm(J, RAX, LUA_TNUMFLT);
+  isflt = jfwd(J, CC_E);
+  cmpregimm(J, RAX, simple[0]);
+  eq[neq++] = jfwd(J, CC_E);  /* nil == nil */
+  cmpregimm(J, RAX, simple[1]);
+  is32 = jfwd(J, CC_E);
+  for (i = 0; i < 3; i++) {
+    cmpregimm(J, RAX, simple[i + 2]);
+    is64[i] = jfwd(J, CC_E);
+  }
+  guard(J, CC_ALWAYS);  /* tables, userdata, long strings... */
+  /* different variants: only numbers may still be equal */
+  patch(J, diff);
+  emitreg(J, 0, 0, 0x81, 4, RAX); e32(J, 0x0F);  /* and eax, 0x0F */
+  emitreg(J, 0, 0, 0x81, 4, RCX); e32(J, 0x0F);  /* and ecx, 0x0F */
+  cmpregimm(J, RAX, LUA_TNUMBER);
+  ne[nne++] = jfwd(J, CC_NE);
+  cmpregimm(J, RCX, LUA_TNUMBER);
+  ne[nne++] = jfwd(J, CC_NE);
+  tofloat(J, 0, rb);  /* an integer and a float: compare as floats */
+  tofloat(J, 1, rc);
+  emitreg(J, 0x66, 0, 0x0F2E, 0, 1);  /* ucomisd xmm0, xmm1 */
+  ne[nne++] = jfwd(J, CC_P);  /* NaN */
+  ne[nne++] = jfwd(J, CC_NE);
+  eq[neq++] = jfwd(J, CC_ALWAYS);
+  patch(J, isint);
+  for (i = 0; i < 3; i++) patch(J, is64[i]);
+  ld64(J, RAX, rb);
+  emitmem(J, 0, 1, 0x3B, RAX, rc);  /* cmp rax, [rc] */
+  eq[neq++] = jfwd(J, CC_E);
+  ne[nne++] = jfwd(J, CC_ALWAYS);
+  patch(J, is32);
+  ld32(J, RAX, rb);
+  emitmem(J, 0, 0, 0x3B, RAX, rc);  /* cmp eax, [rc] */
+  eq[neq++] = jfwd(J, CC_E);
+  ne[nne++] = jfwd(J, CC_ALWAYS);
+  patch(J, isflt);
+  ldsd(J, 0, rb);
+  emitmem(J, 0x66, 0, 0x0F2E, 0, rc);  /* ucomisd xmm0, [rc] */
+  ne[nne++] = jfwd(J, CC_P);  /* NaN */
+  ne[nne++] = jfwd(J, CC_NE);
+  for (i = 0; i < neq; i++) patch(J, eq[i]);
+  condjump(J, ne, nne, a, jtarget);
+}
+
+
+/* if ((RK(B) < RK(C)) ~= A) then pc++ (or '<=' when 'le') */
+static void oplt (JitState *J, Opnd rb, Opnd rc, int le, int a, int jtarget) {
+  int f[2], n1, n2, istrue;
+  cmptag(J, rb, LUA_TNUMINT);
+  n1 = jfwd(J, CC_NE);
+  cmptag(J, rc, LUA_TNUMINT);
+  n2 = jfwd(J, CC_NE);
+  ld64(J, RAX, rb);
+  emitmem(J, 0, 1, 0x3B, RAX, rc);  /* cmp rax, [rc] */
+  f[0] = jfwd(J, le ? 0xF : 0xD);  /* jg/jge: false */
+  istrue = jfwd(J, CC_ALWAYS);
+  patch(J, n1);
+  patch(J, n2);
+  tofloat(J, 0, rc);  /* other numbers are compared as floats */
+  tofloat(J, 1, rb);
+  emitreg(J, 0x66, 0, 0x0F2E, 0, 1);  /* ucomisd xmm0, xmm1 */
+  /* false unless rc > rb (or >=); NaNs set CF and ZF */
+  f[1] = jfwd(J, le ? CC_B : 0x6);  /* jb/jbe */
+  patch(J, istrue);
+  condjump(J, f, 2, a, jtarget);
+}
+
+
+/* if not (R(A) <=> C) then pc++ */
+static void optest (JitState *J, Opnd ra, int c, int jtarget) {
+  int f[2];
+  testfalse(J, ra, &f[0], &f[1]);
+  /* a true value skips the jump when 'c' is 0 */
+  condjump(J, f, 2, c, jtarget);
+}
+
+
+static void forloop (JitState *J, Opnd ra, int target) {
+  int notint, negstep, out[4], cont[2];
+  cmptag(J, ra, LUA_TNUMINT);
+  notint = jfwd(J, CC_NE);
+  ld64(J, RAX, ra);
+  ld64(J, RCX, off(ra, 2 * sizeof(TValue)));  /* step */
+  emitreg(J, 0, 1, 0x01, RCX, RAX);  /* add rax, rcx */
+  emitreg(J, 0, 1, 0x85, RCX, RCX);  /* test rcx, rcx */
+  negstep = jfwd(J, 0xE);  /* jle */
+  emitmem(J, 0, 1, 0x3B, RAX, off(ra, sizeof(TValue)));  /* cmp rax, limit */
+  out[0] = jfwd(J, 0xF);  /* jg: idx > limit */
+  cont[0] = jfwd(J, CC_ALWAYS);
+  patch(J, negstep);
+  emitmem(J, 0, 1, 0x3B, RAX, off(ra, sizeof(TValue)));  /* cmp rax, limit */
+  out[1] = jfwd(J, CC_L);  /* idx < limit */
+  patch(J, cont[0]);
+  st64(J, ra, RAX);
+  st64(J, off(ra, 3 * sizeof(TValue)), RAX);
+  settag(J, off(ra, 3 * sizeof(TValue)), LUA_TNUMINT);
+  jtopc(J, CC_ALWAYS, target);
+  /* float loop */
+  patch(J, notint);
+  ldsd(J, 0, ra);
+  ldsd(J, 1, off(ra, 2 * sizeof(TValue)));  /* step */
+  emitreg(J, 0xF2, 0, 0x0F58, 0, 1);  /* addsd xmm0, xmm1 */
+  emitreg(J, 0x66, 0, 0x0F57, 2, 2);  /* xorpd xmm2, xmm2 */
+  emitreg(J, 0x66, 0, 0x0F2E, 1, 2);  /* ucomisd xmm1, xmm2 */
+  negstep = jfwd(J, CC_A);  /* 0 < step */
+  ldsd(J, 1, off(ra, sizeof(TValue)));  /* limit */
+  emitreg(J, 0x66, 0, 0x0F2E, 0, 1);  /* ucomisd xmm0, xmm1 */
+  out[2] = jfwd(J, CC_B);  /* not (limit <= idx) */
+  cont[0] = jfwd(J, CC_ALWAYS);
+  patch(J, negstep);
+  ldsd(J, 1, off(ra, sizeof(TValue)));  /* limit */
+  emitreg(J, 0x66, 0, 0x0F2E, 1, 0);  /* ucomisd xmm1, xmm0 */
+  out[3] = jfwd(J, CC_B);  /* not (idx <= limit) */
+  patch(J, cont[0]);
+  stsd(J, ra, 0);
+  stsd(J, off(ra, 3 * sizeof(TValue)), 0);
+  settag(J, off(ra, 3 * sizeof(TValue)), LUA_TNUMFLT);
+  jtopc(J, CC_ALWAYS, target);
+  patch(J, out[0]); patch(J, out[1]); patch(J, out[2]); patch(J, out[3]);
+}
+
+
+/*
+** leave rax pointing to the slot 't[k]' in the array part of table 't';
+** exits unless 't' is a table, 'k' an integer and the slot is not nil
+** (so that no metamethod is involved). Leaves the table in rcx.
+*/
+static void arrayslot (JitState *J, Opnd t, Opnd k) {
+  cmptag(J, t, ctb(LUA_TTABLE));
+  guard(J, CC_NE);
+  cmptag(J, k, LUA_TNUMINT);
+  guard(J, CC_NE);
+  ld64(J, RCX, t);
+  ld64(J, RDX, k);
+  emitreg(J, 0, 1, 0xFF, 1, RDX);  /* dec rdx */
+  ld32(J, RAX, opat(RCX, offsetof(Table, sizearray)));
+  emitreg(J, 0, 1, 0x39, RAX, RDX);  /* cmp rdx, rax */
+  guard(J, CC_AE);  /* (unsigned) k - 1 >= sizearray */
+  ld64(J, RAX, opat(RCX, offsetof(Table, array)));
+  emitreg(J, 0, 1, 0xC1, 4, RDX); e8(J, 4);  /* shl rdx, 4 */
+  emitreg(J, 0, 1, 0x01, RDX, RAX);  /* add rax, rdx */
+  cmptag(J, opat(RAX, 0), LUA_TNIL);
+  guard(J, CC_E);
+}
+
+
+/* offset of the elements of a typed array from its Udata */
+#define ELEMOFF		cast_int(sizeof(UUdata))
+
+/*
+** leave rax pointing to element 't[k]' of typed array 't' minus ELEMOFF;
+** exits unless 't' is an array of lua_Integer or lua_Number and 'k' an
+** integer in range. Returns a pending jump taken for integer arrays
+** (falling through for float arrays).
+*/
+static int typedslot (JitState *J, Opnd t, Opnd k) {
+  cmptag(J, t, ctb(LUA_TUSERDATA));
+  guard(J, CC_NE);
+  cmptag(J, k, LUA_TNUMINT);
+  guard(J, CC_NE);
+  ld64(J, RCX, t);
+  /* movzx eax, byte [rcx + arraytype] */
+  emitmem(J, 0, 0, 0x0FB6, RAX, opat(RCX, offsetof(Udata, arraytype)));
+  emitreg(J, 0, 0, 0xFF, 1, RAX);  /* dec eax */
+  cmpregimm(J, RAX, LUA_AFLOAT - 1);
+  guard(J, CC_A);  /* not LUA_AINTEGER or LUA_AFLOAT (8-byte elements) */
+  ld64(J, RDX, k);
+  emitreg(J, 0, 1, 0xFF, 1, RDX);  /* dec rdx */
+  ld64(J, RAX, opat(RCX, offsetof(Udata, len)));
+  emitreg(J, 0, 1, 0xC1, 5, RAX); e8(J, 3);  /* shr rax, 3 */
+  emitreg(J, 0, 1, 0x39, RAX, RDX);  /* cmp rdx, rax */
+  guard(J, CC_AE);  /* (unsigned) k - 1 >= length */
+  emitreg(J, 0, 1, 0xC1, 4, RDX); e8(J, 3);  /* shl rdx, 3 */
+  emitreg(J, 0, 1, 0x8B, RAX, RCX);  /* mov rax, rcx */
+  emitreg(J, 0, 1, 0x01, RDX, RAX);  /* add rax, rdx */
+  /* cmp byte [rcx + arraytype], LUA_AINTEGER */
+  emitmem(J, 0, 0, 0x80, 7, opat(RCX, offsetof(Udata, arraytype)));
+  e8(J, LUA_AINTEGER);
+  return jfwd(J, CC_E);
+}
+
+
+static void gettable (JitState *J, Opnd ra, Opnd rb, Opnd rc) {
+  int typed, isint, done[2];
+  cmptag(J, rb, ctb(LUA_TTABLE));
+  typed = jfwd(J, CC_NE);
+  arrayslot(J, rb, rc);
+  copyval(J, ra, opat(RAX, 0));
+  done[0] = jfwd(J, CC_ALWAYS);
+  patch(J, typed);
+  isint = typedslot(J, rb, rc);
+  ldsd(J, 0, opat(RAX, ELEMOFF));
+  stsd(J, ra, 0);
+  settag(J, ra, LUA_TNUMFLT);
+  done[1] = jfwd(J, CC_ALWAYS);
+  patch(J, isint);
+  ld64(J, RCX, opat(RAX, ELEMOFF));
+  st64(J, ra, RCX);
+  settag(J, ra, LUA_TNUMINT);
+  patch(J, done[0]);
+  patch(J, done[1]);
+}
+
+
+static void settable (JitState *J, Opnd ra, Opnd rb, Opnd rc) {
+  int white, typed, isint, done[2];
+  cmptag(J, ra, ctb(LUA_TUSERDATA));
+  typed = jfwd(J, CC_E);
+  ld32(J, RAX, off(rc, TAGOFF));
+  emitreg(J, 0, 0, 0x85, RAX, RAX);  /* test eax, eax */
+  guard(J, CC_E);  /* do not create holes */
+  e8(J, 0xA9); e32(J, BIT_ISCOLLECTABLE);  /* test eax, imm32 */
+  white = jfwd(J, CC_E);
+  cmptag(J, ra, ctb(LUA_TTABLE));
+  guard(J, CC_NE);
+  ld64(J, RCX, ra);
+  /* test byte [rcx + marked], black: a barrier is needed */
+  emitmem(J, 0, 0, 0xF6, 0, opat(RCX, offsetof(Table, marked)));
+  e8(J, bitmask(BLACKBIT));
+  guard(J, CC_NE);
+  patch(J, white);
+  arrayslot(J, ra, rb);
+  /* invalidateTMcache: mov byte [rcx + flags], 0 */
+  emitmem(J, 0, 0, 0xC6, 0, opat(RCX, offsetof(Table, flags)));
+  e8(J, 0);
+  copyval(J, opat(RAX, 0), rc);
+  done[0] = jfwd(J, CC_ALWAYS);
+  patch(J, typed);  /* typed arrays store only numbers of their own type */
+  isint = typedslot(J, ra, rb);
+  cmptag(J, rc, LUA_TNUMFLT);
+  guard(J, CC_NE);
+  ldsd(J, 0, rc);
+  stsd(J, opat(RAX, ELEMOFF), 0);
+  done[1] = jfwd(J, CC_ALWAYS);
+  patch(J, isint);
+  cmptag(J, rc, LUA_TNUMINT);
+  guard(J, CC_NE);
+  ld64(J, RCX, rc);
+  st64(J, opat(RAX, ELEMOFF), RCX);
+  patch(J, done[0]);
+  patch(J, done[1]);
+}
+
+
+static void getupval (JitState *J, Opnd ra, int b) {
+  ld64(J, RAX, opat(R14, b * cast_int(sizeof(UpVal *))));
+  ld64(J, RAX, opat(RAX, offsetof(UpVal, v)));
+  copyval(J, ra, opat(RAX, 0));
+}
+
+
+/* the OP_JMP following a test, if it can be compiled */
+static int testjump (Proto *p, int pc) {
+  Instruction j = p->code[pc + 1];
+  lua_assert(GET_OPCODE(j) == OP_JMP);
+  if (GETARG_A(j) != 0)  /* has to close upvalues? */
+    return -1;
+  return pc + 2 + GETARG_sBx(j);
+}
+
+
+static void compileop (JitState *J, Proto *p, int pc) {
+  Instruction i = p->code[pc];
+  int a = GETARG_A(i);
+  OpCode op = getBaseOp(GET_OPCODE(i));
+  J->pc = pc;
+  J->nexits = 0;
+  if (J->pcoff) J->pcoff[pc] = J->n;
+  switch (op) {
+    case OP_MOVE:
+      copyval(J, opR(a), opR(GETARG_B(i)));
+      break;
+    case OP_LOADK:
+      copyval(J, opR(a), opK(GETARG_Bx(i)));
+      break;
+    case OP_LOADBOOL:
+      st32imm(J, opR(a), GETARG_B(i));
+      settag(J, opR(a), LUA_TBOOLEAN);
+      if (GETARG_C(i)) jtopc(J, CC_ALWAYS, pc + 2);
+      break;
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      do {
+        settag(J, opR(a++), LUA_TNIL);
+      } while (b--);
+      break;
+    }
+    case OP_GETUPVAL:
+      getupval(J, opR(a), GETARG_B(i));
+      break;
+    case OP_GETTABLE:
+      gettable(J, opR(a), opR(GETARG_B(i)), opRK(GETARG_C(i)));
+      break;
+    case OP_SETTABLE:
+      settable(J, opR(a), opRK(GETARG_B(i)), opRK(GETARG_C(i)));
+      break;
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+      arith(J, op, opR(a), opRK(GETARG_B(i)), opRK(GETARG_C(i)));
+      break;
+    case OP_UNM:
+      unm(J, opR(a), opR(GETARG_B(i)));
+      break;
+    case OP_NOT:
+      opnot(J, opR(a), opR(GETARG_B(i)));
+      break;
+    case OP_JMP:
+      if (a != 0)  /* has to close upvalues? */
+        guard(J, CC_ALWAYS);
+      else
+        jtopc(J, CC_ALWAYS, pc + 1 + GETARG_sBx(i));
+      break;
+    case OP_EQ: case OP_LT: case OP_LE: {
+      int jtarget = testjump(p, pc);
+      if (jtarget < 0)
+        guard(J, CC_ALWAYS);
+      else if (op == OP_EQ)
+        opeq(J, opRK(GETARG_B(i)), opRK(GETARG_C(i)), a, jtarget);
+      else
+        oplt(J, opRK(GETARG_B(i)), opRK(GETARG_C(i)), op == OP_LE, a,
+                jtarget);
+      break;
+    }
+    case OP_TEST: {
+      int jtarget = testjump(p, pc);
+      if (jtarget < 0)
+        guard(J, CC_ALWAYS);
+      else
+        optest(J, opR(a), GETARG_C(i), jtarget);
+      break;
+    }
+    case OP_FORLOOP:
+      forloop(J, opR(a), pc + 1 + GETARG_sBx(i));
+      break;
+    default:  /* no template; let the interpreter do it */
+      guard(J, CC_ALWAYS);
+      break;
+  }
+  if (J->nexits > 0) {  /* add the exit of this template */
+    int k;
+    int next = jfwd(J, CC_ALWAYS);  /* fast path goes on to next pc */
+    for (k = 0; k < J->nexits; k++) patch(J, J->exits[k]);
+    exitto(J, pc);
+    patch(J, next);
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** generate code for all of 'p'. The first part of the code is the
+** entry sequence, which saves the registers used by the templates and
+** jumps to 'entry', followed by the common exit sequence.
+*/
+static void generate (JitState *J, Proto *p) {
+  int pc;
+  J->n = 0;
+  e8(J, 0x53);  /* push rbx */
+  e8(J, 0x41); e8(J, 0x54);  /* push r12 */
+  e8(J, 0x41); e8(J, 0x55);  /* push r13 */
+  e8(J, 0x41); e8(J, 0x56);  /* push r14 */
+  emitreg(J, 0, 1, 0x89, 7, RBX);  /* mov rbx, rdi */
+  emitreg(J, 0, 1, 0x89, 6, R12);  /* mov r12, rsi */
+  emitreg(J, 0, 1, 0x89, RDX, R13);  /* mov r13, rdx */
+  emitreg(J, 0, 1, 0x89, RCX, R14);  /* mov r14, rcx */
+  emitreg(J, 0, 0, 0xFF, 4, R8);  /* jmp r8 */
+  J->epilogue = J->n;
+  e8(J, 0x41); e8(J, 0x5E);  /* pop r14 */
+  e8(J, 0x41); e8(J, 0x5D);  /* pop r13 */
+  e8(J, 0x41); e8(J, 0x5C);  /* pop r12 */
+  e8(J, 0x5B);  /* pop rbx */
+  e8(J, 0xC3);  /* ret */
+  for (pc = 0; pc < p->sizecode; pc++)
+    compileop(J, p, pc);
+}
+
+
+static JitCode *compile (Proto *p) {
+  JitState J;
+  JitCode *jc;
+  size_t header, size;
+  void *mem;
+  if (p->sizecode > MAXJITCODE || sizeof(TValue) != 16)
+    return NULL;
+  J.buff = NULL; J.pcoff = NULL;
+  generate(&J, p);  /* measure code */
+  header = offsetof(JitCode, pcoff) + p->sizecode * sizeof(int);
+  header = (header + 15) & ~cast(size_t, 15);
+  size = header + J.n;
+  mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    return NULL;
+  jc = cast(JitCode *, mem);
+  jc->size = size;
+  jc->code = cast(lu_byte *, mem) + header;
+  J.pcoff = jc->pcoff;
+  generate(&J, p);  /* find offsets of all instructions */
+  J.buff = jc->code;
+  generate(&J, p);  /* now emit code */
+  if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, size);
+    return NULL;
+  }
+  return jc;
+}
+
+
+void luaJ_enter (lua_State *L, CallInfo *ci) {
+  LClosure *cl = clLvalue(ci->func);
+  Proto *p = cl->p;
+  if (p->jit == NULL) {
+    p->jit = compile(p);
+    if (p->jit == NULL) {  /* could not compile it? */
+      p->jithot = MAX_INT;  /* do not try again soon */
+      return;
+    }
+  }
+  if (L->hookmask == 0) {  /* hooks need the interpreter */
+    JitFunction f = cast(JitFunction, cast(void *, p->jit->code));
+    int pc = cast_int(ci->u.l.savedpc - p->code);
+    pc = (*f)(ci->u.l.base, p->k, &L->hookmask, cl->upvals,
+              p->jit->code + p->jit->pcoff[pc]);
+    ci->u.l.savedpc = p->code + pc;
+  }
+}
+
+
+void luaJ_free (lua_State *L, Proto *f) {
+  UNUSED(L);
+  if (f->jit != NULL)
+    munmap(f->jit, f->jit->size);
+}
+
+#endif
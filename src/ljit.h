@@ -0,0 +1,40 @@
+/*
+** $Id: ljit.h $
+** Baseline compiler from Lua bytecode to x86-64 machine code
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/* number of function entries plus loop iterations before compiling */
+#if !defined(LUAI_JITHOT)
+#define LUAI_JITHOT	64
+#endif
+
+
+#if defined(LUA_USE_JIT)
+
+/*
+** count one more function entry or loop iteration of the function
+** running in 'ci' and, once its prototype is compiled, run the
+** compiled code from the current 'savedpc'
+*/
+#define luaJ_check(L,ci,p) \
+	{ if ((p)->jit != NULL || --(p)->jithot == 0) luaJ_enter(L, ci); }
+
+LUAI_FUNC void luaJ_enter (lua_State *L, CallInfo *ci);
+LUAI_FUNC void luaJ_free (lua_State *L, Proto *f);
+
+#else
+
+#define luaJ_check(L,ci,p)	((void)0)
+#define luaJ_free(L,f)		((void)0)
+
+#endif
+
+#endif
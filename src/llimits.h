@@ -35,6 +35,10 @@ typedef long l_mem;
 typedef unsigned char lu_byte;
 
 
+/* 32-bit integers (elements of 'int32' typed arrays) */
+typedef LUA_INT32 l_int32;
+
+
 /* maximum value for size_t */
 #define MAX_SIZET	((size_t)(~(size_t)0))
 
@@ -10,6 +10,9 @@
 #include "lprefix.h"
 
 
+#include <float.h>
+#include <locale.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -257,12 +260,78 @@ static lua_Number lua_strx2number (const char *s, char **endptr) {
 /* }====================================================== */
 
 
+#if defined(LUA_REAL_DOUBLE)
+/*
+** Clinger's fast path: a decimal numeral whose digits fit in 53 bits
+** and whose exponent is at most 22 in absolute value is its digits
+** times or divided by an exact power of 10, so one operation gives the
+** correctly rounded result. Returns NULL for other numerals (which go
+** to 'strtod'). Only '.' is taken as the decimal point.
+*/
+static const char *l_str2dfast (const char *s, lua_Number *result) {
+  static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+    1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18,
+    1e19, 1e20, 1e21, 1e22};
+  lua_Unsigned w = 0;  /* significant digits */
+  int nd = 0;  /* number of significant digits */
+  int any = 0;  /* any digits at all? */
+  int e = 0;  /* decimal exponent */
+  int neg;
+  double r;
+  while (lisspace(cast_uchar(*s))) s++;
+  neg = isneg(&s);
+  for (; lisdigit(cast_uchar(*s)); s++, any = 1) {
+    if (w == 0 && *s == '0') continue;  /* leading zero */
+    if (++nd > 19) return NULL;
+    w = w * 10 + (*s - '0');
+  }
+  if (*s == '.') {
+    for (s++; lisdigit(cast_uchar(*s)); s++, any = 1) {
+      if (w == 0 && *s == '0') { e--; continue; }
+      if (++nd > 19) return NULL;
+      w = w * 10 + (*s - '0');
+      e--;
+    }
+  }
+  if (!any) return NULL;
+  if (*s == 'e' || *s == 'E') {
+    int e1 = 0;
+    int neg1;
+    s++;
+    neg1 = isneg(&s);
+    if (!lisdigit(cast_uchar(*s))) return NULL;
+    for (; lisdigit(cast_uchar(*s)); s++) {
+      if (e1 > 1000) return NULL;
+      e1 = e1 * 10 + (*s - '0');
+    }
+    e += (neg1) ? -e1 : e1;
+  }
+  while (lisspace(cast_uchar(*s))) s++;
+  if (*s != '\0') return NULL;
+  if (w == 0)
+    r = 0.0;
+  else if (w > ((lua_Unsigned)1 << 53) || e < -22 || e > 22)
+    return NULL;
+  else if (e < 0)
+    r = (double)w / pow10[-e];
+  else
+    r = (double)w * pow10[e];
+  *result = (neg) ? -r : r;
+  return s;
+}
+#endif
+
+
 /**
  * 字符串转 lua_Number 类型, 利用标准函数 strtod 实现,
  * 结果保存在 *result 中，成功返回字符串首地址，失败(包括inf, nan)返回 NULL
  */
 static const char *l_str2d (const char *s, lua_Number *result) {
   char *endptr;
+#if defined(LUA_REAL_DOUBLE)
+  const char *e = l_str2dfast(s, result);
+  if (e != NULL) return e;
+#endif
   if (strpbrk(s, "nN"))  /* reject 'inf' and 'nan' */
     return NULL;
   else if (strpbrk(s, "xX"))  /* hex? */
@@ -352,6 +421,218 @@ int luaO_utf8esc (char *buff, unsigned long x) {
 #define MAXNUMBER2STR	50
 
 
+/*
+** {==================================================================
+** Fast conversion of numbers to numerals
+** ===================================================================
+*/
+
+static const char digitpairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233"
+  "34353637383940414243444546474849505152535455565758596061626364656667"
+  "6869707172737475767778798081828384858687888990919293949596979899";
+
+
+/* write the last 'n' digits of 'u' (with leading zeros) ending at 'e' */
+static void putdigits (char *e, lua_Unsigned u, int n) {
+  for (; n >= 2; n -= 2) {
+    const char *d = digitpairs + 2 * (u % 100);
+    u /= 100;
+    *--e = d[1];
+    *--e = d[0];
+  }
+  if (n > 0) *--e = cast(char, '0' + u % 10);
+}
+
+
+static int ndigits (lua_Unsigned u) {
+  int n = 1;
+  for (; u >= 10000; u /= 10000) n += 4;
+  if (u >= 1000) return n + 3;
+  else if (u >= 100) return n + 2;
+  else if (u >= 10) return n + 1;
+  else return n;
+}
+
+
+/* same as 'lua_integer2str' */
+int luaO_int2str (char *buff, lua_Integer i) {
+  lua_Unsigned u = l_castS2U(i);
+  int neg = (i < 0);
+  int n;
+  if (neg) {
+    u = 0u - u;
+    *buff = '-';
+  }
+  n = ndigits(u);
+  putdigits(buff + neg + n, u, n);
+  buff[neg + n] = '\0';
+  return neg + n;
+}
+
+
+#if defined(LUA_REAL_DOUBLE) && defined(LDBL_MANT_DIG) && LDBL_MANT_DIG >= 64
+
+#if !defined(l_getlocaledecpoint)
+#define l_getlocaledecpoint()	(localeconv()->decimal_point[0])
+#endif
+
+/* 10^(16q) for q in [-18, 19] and 10^r for r in [0, 15] (exact) */
+static const long double pow10hi[] = {1e-288L, 1e-272L, 1e-256L, 1e-240L,
+  1e-224L, 1e-208L, 1e-192L, 1e-176L, 1e-160L, 1e-144L, 1e-128L, 1e-112L,
+  1e-96L, 1e-80L, 1e-64L, 1e-48L, 1e-32L, 1e-16L, 1e0L, 1e16L, 1e32L,
+  1e48L, 1e64L, 1e80L, 1e96L, 1e112L, 1e128L, 1e144L, 1e160L, 1e176L,
+  1e192L, 1e208L, 1e224L, 1e240L, 1e256L, 1e272L, 1e288L, 1e304L};
+static const long double pow10lo[] = {1e0L, 1e1L, 1e2L, 1e3L, 1e4L, 1e5L,
+  1e6L, 1e7L, 1e8L, 1e9L, 1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L};
+
+/* 'ax * 10^k' in long double, for 'k' in [-288, 319] */
+#define scale10(ax,k)  \
+	((long double)(ax) * \
+	 (pow10hi[((k) + 288) / 16] * pow10lo[((k) + 288) % 16]))
+
+
+/*
+** Round 'y' (got with 'scale10', so that its error is far below 1e-4)
+** to an integer in '*d'. Returns 0 if 'y' is too close to a rounding
+** tie to decide here.
+*/
+static int roundscaled (long double y, lua_Unsigned *d) {
+  *d = (lua_Unsigned)y;
+  y -= (long double)*d;  /* fractional part */
+  if (y > 0.4999L && y < 0.5001L)
+    return 0;  /* too close to a tie */
+  if (y > 0.5L) (*d)++;
+  return 1;
+}
+
+
+/*
+** Same as 'lua_number2str' ("%.14g"): scale 'x' to 14 integral digits
+** and round them. Returns 0 (leaving it to 'sprintf') for zeros,
+** infinities, NaNs, values beyond 1e+-290, values too close to a
+** rounding tie, and when the locale does not use '.' as the decimal
+** point (so that all floats use the same one).
+*/
+int luaO_flt2str (char *buff, lua_Number x) {
+  long double y;
+  lua_Unsigned d;  /* the 14 significant digits */
+  int e;  /* decimal exponent of first digit */
+  int nd = 14;  /* digits without trailing zeros */
+  int be;
+  char dig[14];
+  char *p = buff;
+  lua_Number ax = l_mathop(fabs)(x);
+  if (!(ax >= 1e-290 && ax <= 1e290))  /* also catches zeros and NaNs */
+    return 0;
+  if (l_getlocaledecpoint() != '.')
+    return 0;
+  l_mathop(frexp)(ax, &be);
+  e = cast_int(l_floor((be - 1) * 0.30102999566398119521));  /* log10 */
+  y = scale10(ax, 13 - e);
+  if (y >= 1e14L) { y /= 10; e++; }
+  else if (y < 1e13L) { y *= 10; e--; }
+  if (!roundscaled(y, &d))
+    return 0;
+  if (d == (lua_Unsigned)100000000000000) {  /* rounded up to 15 digits? */
+    d /= 10;
+    e++;
+  }
+  while (d % 10 == 0) { d /= 10; nd--; }
+  putdigits(dig + nd, d, nd);
+  if (x < 0) *p++ = '-';
+  if (e < -4 || e >= 14) {  /* exponential format */
+    int ae = (e < 0) ? -e : e;
+    *p++ = dig[0];
+    if (nd > 1) {
+      *p++ = '.';
+      memcpy(p, dig + 1, nd - 1);
+      p += nd - 1;
+    }
+    *p++ = 'e';
+    *p++ = (e < 0) ? '-' : '+';
+    if (ae >= 100) {
+      putdigits(p + 3, ae, 3);
+      p += 3;
+    }
+    else {
+      putdigits(p + 2, ae, 2);
+      p += 2;
+    }
+  }
+  else if (e >= 0) {  /* integral part with 'e + 1' digits */
+    if (nd <= e + 1) {
+      memcpy(p, dig, nd);
+      memset(p + nd, '0', e + 1 - nd);
+      p += e + 1;
+    }
+    else {
+      memcpy(p, dig, e + 1);
+      p[e + 1] = '.';
+      memcpy(p + e + 2, dig + e + 1, nd - (e + 1));
+      p += nd + 1;
+    }
+  }
+  else {  /* "0.", zeros, and the digits */
+    *p++ = '0';
+    *p++ = '.';
+    memset(p, '0', -e - 1);
+    p += -e - 1;
+    memcpy(p, dig, nd);
+    p += nd;
+  }
+  *p = '\0';
+  return cast_int(p - buff);
+}
+
+
+/*
+** Same as "%.<prec>f" for 'prec' in [0, 9] and values below 1e15 after
+** scaling. Returns 0 (leaving it to 'sprintf') for other values, values
+** too close to a rounding tie, and when the locale does not use '.' as
+** the decimal point.
+*/
+int luaO_fixed2str (char *buff, lua_Number x, int prec) {
+  int neg = (x < 0 || (x == 0 && 1 / x < 0));  /* also for -0.0 */
+  char *p = buff;
+  long double y;
+  lua_Unsigned d, ip;
+  if (prec < 0 || prec > 9)
+    return 0;
+  y = scale10(neg ? -x : x, prec);
+  if (!(y < 1e15L))  /* too large, infinite, or NaN? */
+    return 0;
+  if (l_getlocaledecpoint() != '.' || !roundscaled(y, &d))
+    return 0;
+  ip = d / (lua_Unsigned)pow10lo[prec];
+  if (neg) *p++ = '-';
+  p += luaO_int2str(p, l_castU2S(ip));
+  if (prec > 0) {
+    *p++ = '.';
+    putdigits(p + prec, d - ip * (lua_Unsigned)pow10lo[prec], prec);
+    p += prec;
+  }
+  *p = '\0';
+  return cast_int(p - buff);
+}
+
+#else
+
+int luaO_flt2str (char *buff, lua_Number x) {
+  UNUSED(buff); UNUSED(x);
+  return 0;
+}
+
+int luaO_fixed2str (char *buff, lua_Number x, int prec) {
+  UNUSED(buff); UNUSED(x); UNUSED(prec);
+  return 0;
+}
+
+#endif
+
+/* }================================================================== */
+
+
 /*
 ** Convert a number object to a string
 */
@@ -361,9 +642,11 @@ void luaO_tostring (lua_State *L, StkId obj) {
   size_t len;
   lua_assert(ttisnumber(obj));
   if (ttisinteger(obj))
-    len = lua_integer2str(buff, ivalue(obj));
+    len = luaO_int2str(buff, ivalue(obj));
   else {
-    len = lua_number2str(buff, fltvalue(obj));
+    len = luaO_flt2str(buff, fltvalue(obj));
+    if (len == 0)
+      len = lua_number2str(buff, fltvalue(obj));
 #if !defined(LUA_COMPAT_FLOATSTRING)
 	/* strspn 这个函数少见, 功能也比较逗，用在这倒也正合适 */
 	/* 其实直接查字符串中有没有 '.' 字符也可以 */
@@ -381,6 +381,7 @@ typedef struct TString {
    * reserved words 在 llex.c 中, 作为索引位置, 下标从 1 开始
    */
   lu_byte extra;  /* reserved words for short strings; "has hash" for longs */
+  lu_byte isext;  /* true for external long strings */
   /* hash code of string */
   unsigned int hash;
   size_t len;  /* number of characters in string */
@@ -425,14 +426,28 @@ typedef union UTString {
 } UTString;
 
 
+/*
+** An external long string does not hold its bytes: where other strings
+** have them, it has a pointer to bytes owned by the host, and the
+** function to release them when the string is collected.
+*/
+typedef struct ExtString {
+  const char *contents;  /* 'len' bytes followed by a '\0' */
+  lua_Release release;  /* function to release 'contents' (or NULL) */
+  void *ud;  /* argument to 'release' */
+} ExtString;
+
+
 /*
 ** Get the actual string (array of bytes) from a 'TString'.
 ** (Access to 'extra' ensures that value is really a 'TString'.)
 */
 /* 注意 const 的区别 */
 #define getaddrstr(ts)	(cast(char *, (ts)) + sizeof(UTString))
+#define getextstr(ts)	check_exp((ts)->isext, cast(ExtString *, getaddrstr(ts)))
 #define getstr(ts)  \
-  check_exp(sizeof((ts)->extra), cast(const char*, getaddrstr(ts)))
+  check_exp(sizeof((ts)->extra), cast(const char*, \
+    (ts)->isext ? getextstr(ts)->contents : getaddrstr(ts)))
 
 /* get the actual string (array of bytes) from a Lua value */
 #define svalue(o)       getstr(tsvalue(o))
@@ -448,6 +463,7 @@ typedef union UTString {
 typedef struct Udata {
   CommonHeader;
   lu_byte ttuv_;  /* user value's tag */
+  lu_byte arraytype;  /* element type of a typed array (0 if not one) */
   struct Table *metatable;
   size_t len;  /* number of bytes */
   union Value user_;  /* user value */
@@ -470,6 +486,16 @@ typedef union UUdata {
 #define getudatamem(u)  \
   check_exp(sizeof((u)->ttuv_), (cast(char*, (u)) + sizeof(UUdata)))
 
+/*
+** Typed arrays are userdata whose memory is a plain C vector of
+** elements of type 'arraytype' (one of the LUA_A* constants).
+*/
+#define arrayelemsize(t)	lua_arrayelemsize(t)
+
+/* number of elements in typed array 'u' */
+#define arraylen(u)	((u)->len / arrayelemsize((u)->arraytype))
+
+
 /**
  * 将 o 指向的对象的值和类型赋给 u 指向的userdata对象
  */
@@ -495,6 +521,7 @@ typedef struct Upvaldesc {
   TString *name;  /* upvalue name (for debug information) */
   lu_byte instack;  /* whether it is in stack */
   lu_byte idx;  /* index of upvalue (in stack or in outer function's list) */
+  lu_byte readonly;  /* whether captured variable is never assigned */
 } Upvaldesc;
 
 
@@ -536,6 +563,8 @@ typedef struct Proto {
   /* 是个数组指针 */
   Upvaldesc *upvalues;  /* upvalue information */
   struct LClosure *cache;  /* last created closure with this prototype */
+  struct JitCode *jit;  /* machine code for this prototype (see ljit.c) */
+  int jithot;  /* countdown to compilation */
   TString  *source;  /* used for debug information */
   GCObject *gclist;
 } Proto;
@@ -553,7 +582,7 @@ typedef struct UpVal UpVal;
 */
 
 #define ClosureHeader \
-	CommonHeader; lu_byte nupvalues; GCObject *gclist
+	CommonHeader; lu_byte nupvalues; lu_byte nflat; GCObject *gclist
 
 typedef struct CClosure {
   ClosureHeader;
@@ -630,6 +659,8 @@ typedef struct Table {
   /* node array 的大小总是是 2 的整数次方 */
   lu_byte lsizenode;  /* log2 of size of 'node' array */
   unsigned int sizearray;  /* size of 'array' array */
+  unsigned int lenhint;  /* last boundary found by 'luaH_getn' */
+  unsigned int nexthint;  /* position of last key given by 'luaH_next' */
   /* sequence array */
   TValue *array;  /* array part */
   /* node hash table */
@@ -694,6 +725,9 @@ LUAI_FUNC size_t luaO_str2num (const char *s, TValue *o);
 LUAI_FUNC int luaO_hexavalue (int c);
 /* 将 number 对象转成字符串, 如 5， 5.0， 5e9 */
 LUAI_FUNC void luaO_tostring (lua_State *L, StkId obj);
+LUAI_FUNC int luaO_int2str (char *buff, lua_Integer i);
+LUAI_FUNC int luaO_flt2str (char *buff, lua_Number x);
+LUAI_FUNC int luaO_fixed2str (char *buff, lua_Number x, int prec);
 /* this function handles only '%d', '%c', '%f', '%p', and '%s' 
    conventional formats, plus Lua-specific '%I' and '%U' */
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt,
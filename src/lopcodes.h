@@ -251,12 +251,17 @@ OP_CLOSURE,		/*	A Bx	R(A) := closure(KPROTO[Bx])						*/
 
 OP_VARARG,		/*	A B		R(A), R(A+1), ..., R(A+B-2) = vararg			*/
 
-OP_EXTRAARG		/*	Ax		extra (larger) argument for previous opcode		*/
+OP_EXTRAARG,	/*	Ax		extra (larger) argument for previous opcode		*/
+
+/* superinstructions: see note (*) below */
+OP_GETTABUPGT,	/*	A B C	OP_GETTABUP, then the OP_GETTABLE that follows	*/
+OP_GETUPVALGT,	/*	A B		OP_GETUPVAL, then the OP_GETTABLE that follows	*/
+OP_SELFCALL		/*	A B C	OP_SELF, then the OP_CALL that follows			*/
 } OpCode;
 
 
 /* 指令集指令数量 */
-#define NUM_OPCODES	(cast(int, OP_EXTRAARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_SELFCALL) + 1)
 
 
 
@@ -281,6 +286,13 @@ OP_EXTRAARG		/*	Ax		extra (larger) argument for previous opcode		*/
 
   (*) All 'skips' (pc++) assume that next instruction is a jump.
 
+  (*) A superinstruction replaces only the opcode of the first instruction
+  of a pair; its arguments and the whole second instruction are kept.
+  The interpreter runs the second one right after the first without a
+  new dispatch, but it is still a complete instruction with its own line
+  info, so jumps into it, hooks, and yields inside either half behave
+  as with the unfused pair. 'getBaseOp' gives the original opcode.
+
 ===========================================================================*/
 
 
@@ -313,6 +325,12 @@ LUAI_DDEC const lu_byte luaP_opmodes[NUM_OPCODES];
 #define testTMode(m)	(luaP_opmodes[m] & (1 << 7))
 
 
+LUAI_DDEC const lu_byte luaP_opbase[NUM_OPCODES];
+
+/* opcode of a superinstruction before fusion (itself for other opcodes) */
+#define getBaseOp(m)	(cast(OpCode, luaP_opbase[m]))
+
+
 LUAI_DDEC const char *const luaP_opnames[NUM_OPCODES+1];  /* opcode names */
 
 
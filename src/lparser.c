@@ -179,7 +179,11 @@ static void new_localvar (LexState *ls, TString *name) {
                   MAXVARS, "local variables");
   luaM_growvector(ls->L, dyd->actvar.arr, dyd->actvar.n + 1,
                   dyd->actvar.size, Vardesc, MAX_INT, "local variables");
-  dyd->actvar.arr[dyd->actvar.n++].idx = cast(short, reg);
+  dyd->actvar.arr[dyd->actvar.n].idx = cast(short, reg);
+  dyd->actvar.arr[dyd->actvar.n].assigned = 0;
+  dyd->actvar.arr[dyd->actvar.n].captured = 0;
+  dyd->actvar.arr[dyd->actvar.n].firstp = fs->np;
+  dyd->actvar.n++;
 }
 
 
@@ -191,6 +195,11 @@ static void new_localvarliteral_ (LexState *ls, const char *name, size_t sz) {
 	new_localvarliteral_(ls, "" v, (sizeof(v)/sizeof(char))-1)
 
 
+static Vardesc *getvardesc (FuncState *fs, int i) {
+  return &fs->ls->dyd->actvar.arr[fs->firstlocal + i];
+}
+
+
 static LocVar *getlocvar (FuncState *fs, int i) {
   int idx = fs->ls->dyd->actvar.arr[fs->firstlocal + i].idx;
   lua_assert(idx < fs->nlocvars);
@@ -207,10 +216,40 @@ static void adjustlocalvars (LexState *ls, int nvars) {
 }
 
 
+/*
+** Mark the upvalues of 'f' that refer to variable 'idx' (a register of
+** the enclosing function when 'instack', else one of its upvalues) as
+** read-only, and do the same for the functions nested in 'f' that
+** capture them in turn.
+*/
+static void markreadonly (Proto *f, int instack, int idx) {
+  int i, j;
+  for (i = 0; i < f->sizeupvalues; i++) {
+    Upvaldesc *up = &f->upvalues[i];
+    if (up->instack == instack && up->idx == idx) {
+      up->readonly = 1;
+      for (j = 0; j < f->sizep; j++)
+        markreadonly(f->p[j], 0, i);
+    }
+  }
+}
+
+
+/*
+** At the end of its scope, a captured variable that was never assigned
+** is known to keep its initial value; tell the functions capturing it.
+*/
 static void removevars (FuncState *fs, int tolevel) {
   fs->ls->dyd->actvar.n -= (fs->nactvar - tolevel);
-  while (fs->nactvar > tolevel)
-    getlocvar(fs, --fs->nactvar)->endpc = fs->pc;
+  while (fs->nactvar > tolevel) {
+    Vardesc *vd = getvardesc(fs, --fs->nactvar);
+    if (vd->captured && !vd->assigned) {
+      int i;
+      for (i = vd->firstp; i < fs->np; i++)
+        markreadonly(fs->f->p[i], 1, fs->nactvar);
+    }
+    getlocvar(fs, fs->nactvar)->endpc = fs->pc;
+  }
 }
 
 
@@ -233,6 +272,7 @@ static int newupvalue (FuncState *fs, TString *name, expdesc *v) {
   while (oldsize < f->sizeupvalues) f->upvalues[oldsize++].name = NULL;
   f->upvalues[fs->nups].instack = (v->k == VLOCAL);
   f->upvalues[fs->nups].idx = cast_byte(v->u.info);
+  f->upvalues[fs->nups].readonly = 0;  /* set when variable goes out of scope */
   f->upvalues[fs->nups].name = name;
   luaC_objbarrier(fs->ls->L, f, name);
   return fs->nups++;
@@ -257,6 +297,29 @@ static void markupval (FuncState *fs, int level) {
   BlockCnt *bl = fs->bl;
   while (bl->nactvar > level) bl = bl->previous;
   bl->upval = 1;
+  getvardesc(fs, level)->captured = 1;
+}
+
+
+/*
+  Mark the local variable assigned through 'v' as assigned. For an
+  upvalue, follow the chain of upvalues up to the function where the
+  variable is local.
+*/
+static void markassigned (FuncState *fs, expdesc *v) {
+  int idx = v->u.info;
+  if (v->k == VUPVAL) {
+    Upvaldesc *up;
+    do {
+      up = &fs->f->upvalues[idx];
+      fs = fs->prev;
+      if (fs == NULL) return;  /* main function's '_ENV' */
+      idx = up->idx;
+    } while (!up->instack);
+  }
+  else if (v->k != VLOCAL)
+    return;
+  getvardesc(fs, idx)->assigned = 1;
 }
 
 
@@ -549,6 +612,7 @@ static void close_func (LexState *ls) {
   Proto *f = fs->f;
   luaK_ret(fs, 0, 0);  /* final return */
   leaveblock(fs);
+  luaK_fuse(fs);
   luaM_reallocvector(L, f->code, f->sizecode, fs->pc, Instruction);
   f->sizecode = fs->pc;
   luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, fs->pc, int);
@@ -1141,6 +1205,7 @@ static void check_conflict (LexState *ls, struct LHS_assign *lh, expdesc *v) {
 static void assignment (LexState *ls, struct LHS_assign *lh, int nvars) {
   expdesc e;
   check_condition(ls, vkisvar(lh->v.k), "syntax error");
+  markassigned(ls->fs, &lh->v);
   if (testnext(ls, ',')) {  /* assignment -> ',' suffixedexp assignment */
     struct LHS_assign nv;
     nv.prev = lh;
@@ -1431,6 +1496,8 @@ static void localfunc (LexState *ls) {
   new_localvar(ls, str_checkname(ls));  /* new local variable */
   adjustlocalvars(ls, 1);  /* enter its scope */
   body(ls, &b, 0, ls->linenumber);  /* function created in next register */
+  /* the function itself captures the variable before it is set */
+  getvardesc(fs, b.u.info)->firstp = fs->np;
   /* debug information will only see the variable after this point! */
   getlocvar(fs, b.u.info)->startpc = fs->pc;
 }
@@ -1476,6 +1543,7 @@ static void funcstat (LexState *ls, int line) {
   expdesc v, b;
   luaX_next(ls);  /* skip FUNCTION */
   ismethod = funcname(ls, &v);
+  markassigned(ls->fs, &v);
   body(ls, &b, ismethod, line);
   luaK_storevar(ls->fs, &v, &b);
   luaK_fixline(ls->fs, line);  /* definition "happens" in the first line */
@@ -58,6 +58,9 @@ typedef struct expdesc {
 /* description of active local variable */
 typedef struct Vardesc {
   short idx;  /* variable index in stack */
+  lu_byte assigned;  /* whether variable is assigned after declaration */
+  lu_byte captured;  /* whether variable is used as an upvalue */
+  int firstp;  /* first nested function that may capture it */
 } Vardesc;
 
 
@@ -0,0 +1,352 @@
+/*
+** $Id: lsort.c $
+** In-place sorting of the array part of tables
+** See Copyright Notice in lua.h
+*/
+
+#define lsort_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include "lua.h"
+
+#include "ldebug.h"
+#include "ldo.h"
+#include "lobject.h"
+#include "lsort.h"
+#include "lstate.h"
+#include "ltable.h"
+#include "lvm.h"
+
+
+/*
+** The engine is a pattern-defeating quicksort (Orson Peters, 2016):
+** introsort with a heapsort fallback after too many unbalanced
+** partitions, shuffling of some elements to break up patterns that
+** make quicksort degenerate, a partition that puts all elements equal
+** to the previous pivot aside in one pass, and early exit on runs that
+** are already in order.
+**
+** All data movement is done by swapping two entries of the array, so
+** that the table always holds all its original values: an error (or
+** a GC cycle) inside a comparison never sees a value missing from it.
+** All loops check their bounds, so an inconsistent order function (or
+** a NaN) yields some permutation of the array instead of an overflow.
+** As in the old quicksort, such a function is reported when it makes
+** a partition overrun its range, which a consistent order cannot do.
+*/
+
+
+/* partitions smaller than this are sorted by insertion sort */
+#define INSSORT_LIMIT		24
+
+/* partitions larger than this use a pseudo-median of nine as pivot */
+#define NINTHER_LIMIT		128
+
+/* maximum number of moves 'partinssort' does before giving up */
+#define PARTINS_LIMIT		8
+
+
+/* what is in the array, and so how to compare two elements */
+enum SortKind { SORT_INT, SORT_FLT, SORT_STR, SORT_ANY };
+
+
+typedef struct SortState {
+  lua_State *L;
+  Table *t;
+  TValue *a;  /* array being sorted (must not move) */
+  unsigned int n;  /* number of elements being sorted */
+  TValue f;  /* order function or nil for '<' */
+} SortState;
+
+
+#define swapval(x,y)  { TValue temp_; setobj(S->L, &temp_, x); \
+    setobj(S->L, x, y); setobj(S->L, y, &temp_); }
+
+
+/*
+** Comparison for arrays of arbitrary values: call the order function
+** (or use '<' with its metamethods) and then check that the array was
+** not moved or shrunk by it.
+*/
+static int sortcall (SortState *S, const TValue *x, const TValue *y) {
+  lua_State *L = S->L;
+  int res;
+  if (ttisnil(&S->f))
+    res = luaV_lessthan(L, x, y);
+  else {
+    StkId func;
+    luaD_checkstack(L, 3);
+    func = L->top;
+    setobj2s(L, func, &S->f);
+    setobj2s(L, func + 1, x);
+    setobj2s(L, func + 2, y);
+    L->top = func + 3;
+    luaD_call(L, func, 1, 0);
+    res = !l_isfalse(L->top - 1);
+    L->top--;
+  }
+  if (S->t->array != S->a || S->t->sizearray < S->n)
+    luaG_runerror(L, "table modified during sort");
+  return res;
+}
+
+
+#define ltint(S,x,y)	(ivalue(x) < ivalue(y))
+#define ltflt(S,x,y)	luai_numlt(fltvalue(x), fltvalue(y))
+#define ltstr(S,x,y)	(tsvalue(x) != tsvalue(y) && \
+                         luaV_strcmp(tsvalue(x), tsvalue(y)) < 0)
+#define ltany(S,x,y)	sortcall(S, x, y)
+
+
+/*
+** Define the sorting functions for one kind of array, with 'lt' as
+** its less-than operation. Ranges are given as [lo, hi).
+*/
+#define SORTFUNCS(K,lt)  \
+\
+static void sort2##K (SortState *S, TValue *x, TValue *y) { \
+  if (lt(S, y, x)) swapval(x, y); \
+} \
+\
+/* order 'x', 'y', 'z' (so that the median ends up in 'y') */ \
+static void sort3##K (SortState *S, TValue *x, TValue *y, TValue *z) { \
+  sort2##K(S, x, y); \
+  sort2##K(S, y, z); \
+  sort2##K(S, x, y); \
+} \
+\
+static void inssort##K (SortState *S, TValue *lo, TValue *hi) { \
+  TValue *p, *q; \
+  for (p = lo + 1; p < hi; p++) { \
+    for (q = p; q > lo && lt(S, q, q - 1); q--) \
+      swapval(q, q - 1); \
+  } \
+} \
+\
+/* insertion sort that gives up after a few moves; true if it sorted */ \
+static int partinssort##K (SortState *S, TValue *lo, TValue *hi) { \
+  TValue *p, *q; \
+  int moves = 0; \
+  for (p = lo + 1; p < hi; p++) { \
+    for (q = p; q > lo && lt(S, q, q - 1); q--) { \
+      swapval(q, q - 1); \
+      moves++; \
+    } \
+    if (moves > PARTINS_LIMIT) return 0; \
+  } \
+  return 1; \
+} \
+\
+/* \
+** Partition around pivot '*lo': elements smaller than the pivot go \
+** to its left, the others to its right. Return the final position \
+** of the pivot; '*noswaps' tells whether the range was already \
+** partitioned. The pivot is a median of some elements of the range, \
+** so at least one other element is not smaller than it: finding all \
+** of them smaller means the order is invalid. \
+*/ \
+static TValue *partright##K (SortState *S, TValue *lo, TValue *hi, \
+                             int *noswaps) { \
+  TValue *i = lo + 1; \
+  TValue *j = hi - 1; \
+  *noswaps = 1; \
+  for (;;) { \
+    while (i <= j && lt(S, i, lo)) i++; \
+    while (i <= j && !lt(S, j, lo)) j--; \
+    if (i > j) break; \
+    swapval(i, j); \
+    *noswaps = 0; \
+    i++; j--; \
+  } \
+  if (i == hi)  /* every element smaller than the pivot? */ \
+    luaG_runerror(S->L, "invalid order function for sorting"); \
+  swapval(lo, i - 1); \
+  return i - 1; \
+} \
+\
+/* \
+** Partition around pivot '*lo' putting elements equal to it on its \
+** left. Used when the pivot is equal to the element right before the \
+** range (a previous pivot), so that everything on the left is equal. \
+*/ \
+static TValue *partleft##K (SortState *S, TValue *lo, TValue *hi) { \
+  TValue *i = lo + 1; \
+  TValue *j = hi - 1; \
+  for (;;) { \
+    while (i <= j && !lt(S, lo, i)) i++; \
+    while (i <= j && lt(S, lo, j)) j--; \
+    if (i > j) break; \
+    swapval(i, j); \
+    i++; j--; \
+  } \
+  swapval(lo, i - 1); \
+  return i - 1; \
+} \
+\
+static void siftdown##K (SortState *S, TValue *a, size_t i, size_t n) { \
+  for (;;) { \
+    size_t c = 2 * i + 1; \
+    if (c >= n) break; \
+    if (c + 1 < n && lt(S, a + c, a + c + 1)) c++; \
+    if (!lt(S, a + i, a + c)) break; \
+    swapval(a + i, a + c); \
+    i = c; \
+  } \
+} \
+\
+static void heapsort##K (SortState *S, TValue *lo, TValue *hi) { \
+  size_t n = hi - lo; \
+  size_t i; \
+  for (i = n / 2; i-- > 0; ) \
+    siftdown##K(S, lo, i, n); \
+  while (n > 1) { \
+    n--; \
+    swapval(lo, lo + n); \
+    siftdown##K(S, lo, 0, n); \
+  } \
+} \
+\
+/* swap some elements of a partition of 'size' elements around */ \
+static void breakpatterns##K (SortState *S, TValue *lo, TValue *hi, \
+                              size_t size) { \
+  if (size >= INSSORT_LIMIT) { \
+    size_t q = size / 4; \
+    swapval(lo, lo + q); \
+    swapval(hi - 1, hi - q); \
+    if (size > NINTHER_LIMIT) { \
+      swapval(lo + 1, lo + (q + 1)); \
+      swapval(lo + 2, lo + (q + 2)); \
+      swapval(hi - 2, hi - (q + 1)); \
+      swapval(hi - 3, hi - (q + 2)); \
+    } \
+  } \
+} \
+\
+/* \
+** 'bad' is the number of unbalanced partitions still allowed before \
+** switching to heapsort; 'leftmost' tells whether 'lo[-1]' is out of \
+** the range being sorted (otherwise it is a previous pivot). Recurse \
+** into the smaller partition and loop over the larger one. \
+*/ \
+static void pdqsort##K (SortState *S, TValue *lo, TValue *hi, int bad, \
+                        int leftmost) { \
+  for (;;) { \
+    size_t size = hi - lo; \
+    size_t half = size / 2; \
+    size_t lsize, rsize; \
+    TValue *p; \
+    int noswaps; \
+    if (size < INSSORT_LIMIT) { \
+      inssort##K(S, lo, hi); \
+      return; \
+    } \
+    if (size > NINTHER_LIMIT) { \
+      sort3##K(S, lo, lo + half, hi - 1); \
+      sort3##K(S, lo + 1, lo + (half - 1), hi - 2); \
+      sort3##K(S, lo + 2, lo + (half + 1), hi - 3); \
+      sort3##K(S, lo + (half - 1), lo + half, lo + (half + 1)); \
+      swapval(lo, lo + half); \
+    } \
+    else \
+      sort3##K(S, lo + half, lo, hi - 1); \
+    if (!leftmost && !lt(S, lo - 1, lo)) {  /* pivot == previous pivot? */ \
+      lo = partleft##K(S, lo, hi) + 1;  /* skip all elements equal to it */ \
+      continue; \
+    } \
+    p = partright##K(S, lo, hi, &noswaps); \
+    lsize = p - lo; \
+    rsize = hi - (p + 1); \
+    if (lsize < size / 8 || rsize < size / 8) {  /* unbalanced? */ \
+      if (--bad == 0) { \
+        heapsort##K(S, lo, hi); \
+        return; \
+      } \
+      breakpatterns##K(S, lo, p, lsize); \
+      breakpatterns##K(S, p + 1, hi, rsize); \
+    } \
+    else if (noswaps && partinssort##K(S, lo, p) && \
+                        partinssort##K(S, p + 1, hi)) \
+      return;  /* range was (almost) sorted */ \
+    if (lsize < rsize) { \
+      pdqsort##K(S, lo, p, bad, leftmost); \
+      lo = p + 1; \
+      leftmost = 0; \
+    } \
+    else { \
+      pdqsort##K(S, p + 1, hi, bad, 0); \
+      hi = p; \
+    } \
+  } \
+}
+
+
+SORTFUNCS(int, ltint)
+SORTFUNCS(flt, ltflt)
+SORTFUNCS(str, ltstr)
+SORTFUNCS(any, ltany)
+
+
+/*
+** Kind of the elements in the array: specialized comparisons need all
+** elements with the same type (and no NaNs, which break the order).
+*/
+static enum SortKind sortkind (const TValue *a, unsigned int n) {
+  unsigned int i;
+  if (ttisinteger(&a[0])) {
+    for (i = 1; i < n; i++)
+      if (!ttisinteger(&a[i])) return SORT_ANY;
+    return SORT_INT;
+  }
+  else if (ttisfloat(&a[0])) {
+    for (i = 0; i < n; i++)
+      if (!ttisfloat(&a[i]) || luai_numisnan(fltvalue(&a[i])))
+        return SORT_ANY;
+    return SORT_FLT;
+  }
+  else if (ttisstring(&a[0])) {
+    for (i = 1; i < n; i++)
+      if (!ttisstring(&a[i])) return SORT_ANY;
+    return SORT_STR;
+  }
+  else
+    return SORT_ANY;
+}
+
+
+/*
+** Sort 't[1..n]' in place, with 'f' as the order function (or '<' if
+** 'f' is NULL). Return 0, without touching the table, if these entries
+** are not all in its array part.
+*/
+int luaH_sort (lua_State *L, Table *t, lua_Integer n, const TValue *f) {
+  SortState S;
+  TValue *lo, *hi;
+  int bad;
+  if (n < 0 || (lua_Unsigned)n > t->sizearray)
+    return 0;
+  if (n < 2)
+    return 1;  /* nothing to sort */
+  S.L = L;
+  S.t = t;
+  S.a = t->array;
+  S.n = cast(unsigned int, n);
+  if (f == NULL)
+    setnilvalue(&S.f);
+  else {
+    setobj(L, &S.f, f);
+  }
+  lo = S.a;
+  hi = S.a + S.n;
+  bad = luaO_ceillog2(S.n);
+  switch (f ? SORT_ANY : sortkind(S.a, S.n)) {
+    case SORT_INT: pdqsortint(&S, lo, hi, bad, 1); break;
+    case SORT_FLT: pdqsortflt(&S, lo, hi, bad, 1); break;
+    case SORT_STR: pdqsortstr(&S, lo, hi, bad, 1); break;
+    default: pdqsortany(&S, lo, hi, bad, 1); break;
+  }
+  return 1;
+}
+
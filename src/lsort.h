@@ -0,0 +1,18 @@
+/*
+** $Id: lsort.h $
+** In-place sorting of the array part of tables
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lsort_h
+#define lsort_h
+
+
+#include "lobject.h"
+
+
+LUAI_FUNC int luaH_sort (lua_State *L, Table *t, lua_Integer n,
+                                       const TValue *f);
+
+
+#endif
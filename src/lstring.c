@@ -120,6 +120,7 @@ static TString *createstrobj (lua_State *L, const char *str, size_t l,
   ts->hash = h;
   /* 还没有计算 hash 值 */
   ts->extra = 0;
+  ts->isext = 0;
   memcpy(getaddrstr(ts), str, l * sizeof(char));
   getaddrstr(ts)[l] = '\0';  /* ending 0 */
   return ts;
@@ -200,6 +201,35 @@ TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
 }
 
 
+/*
+** new external string: a long string keeps using 'str', which must be
+** followed by a '\0', and calls 'release' when it is collected. Short
+** strings must be internalized, so they are copied and 'str' released
+** at once.
+*/
+TString *luaS_newextlstr (lua_State *L, const char *str, size_t l,
+                          lua_Release release, void *ud) {
+  TString *ts;
+  ExtString *e;
+  if (l <= LUAI_MAXSHORTLEN) {
+    ts = internshrstr(L, str, l);
+    if (release != NULL)
+      release(ud, str, l);
+    return ts;
+  }
+  ts = gco2ts(luaC_newobj(L, LUA_TLNGSTR, sizeextstring));
+  ts->len = l;
+  ts->hash = G(L)->seed;
+  ts->extra = 0;
+  ts->isext = 1;
+  e = getextstr(ts);
+  e->contents = str;
+  e->release = release;
+  e->ud = ud;
+  return ts;
+}
+
+
 /*
 ** new zero-terminated string
 */
@@ -219,6 +249,7 @@ Udata *luaS_newudata (lua_State *L, size_t s) {
   o = luaC_newobj(L, LUA_TUSERDATA, sizeludata(s));
   u = gco2u(o);
   u->len = s;
+  u->arraytype = 0;
   u->metatable = NULL;
   /* 将该对象设为 nil  */
   setuservalue(L, u, luaO_nilobject);
@@ -14,7 +14,8 @@
 
 /* l: 为C字符串长度, 这个宏计算对应的 Lua 字符串长度 */
 #define sizelstring(l)  (sizeof(union UTString) + ((l) + 1) * sizeof(char))
-#define sizestring(s)	sizelstring((s)->len)
+#define sizeextstring	(sizeof(union UTString) + sizeof(ExtString))
+#define sizestring(s)	((s)->isext ? sizeextstring : sizelstring((s)->len))
 
 #define sizeludata(l)	(sizeof(union UUdata) + (l))
 #define sizeudata(u)	sizeludata((u)->len)
@@ -48,6 +49,8 @@ LUAI_FUNC void luaS_remove (lua_State *L, TString *ts);
 LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s);
 /* new string (with explicit length), 会重复利用短字符串资源 */
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
+LUAI_FUNC TString *luaS_newextlstr (lua_State *L, const char *str, size_t l,
+                                    lua_Release release, void *ud);
 /**
  * 新建一个以'\0'结尾的字符串
  */
@@ -12,6 +12,7 @@
 
 #include <ctype.h>
 #include <limits.h>
+#include <locale.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,6 +24,11 @@
 #include "lualib.h"
 
 
+#if defined(LUA_USE_SIMD)
+#include <emmintrin.h>
+#endif
+
+
 /*
 ** maximum number of captures that a pattern can do during
 ** pattern-matching. This limit is arbitrary.
@@ -92,21 +98,66 @@ static int str_reverse (lua_State *L) {
   const char *s = luaL_checklstring(L, 1, &l);
   /* 分配大小至少为 l 的 buffer */
   char *p = luaL_buffinitsize(L, &b, l);
-  for (i = 0; i < l; i++)
+  i = 0;
+#if defined(LUA_USE_SIMD)
+  for (; i + 16 <= l; i += 16) {  /* reverse 16 bytes at a time */
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + l - i - 16));
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    v = _mm_shufflelo_epi16(v, 0x1B);
+    v = _mm_shufflehi_epi16(v, 0x1B);
+    v = _mm_shuffle_epi32(v, 0x4E);
+    _mm_storeu_si128((__m128i *)(p + i), v);
+  }
+#endif
+  for (; i < l; i++)
     p[i] = s[l - i - 1];
   luaL_pushresultsize(&b, l);
   return 1;
 }
 
 
+/*
+** Is the C locale active for character classes? Then 'tolower' and
+** 'toupper' change only ASCII letters.
+*/
+static int clocale (void) {
+  const char *loc = setlocale(LC_CTYPE, NULL);
+  return (loc != NULL && (strcmp(loc, "C") == 0 || strcmp(loc, "POSIX") == 0));
+}
+
+
+/* flip the case of the 26 letters from 'first' in 's', into 'p' */
+static void asciicase (char *p, const char *s, size_t l, int first) {
+  size_t i = 0;
+#if defined(LUA_USE_SIMD)
+  __m128i lo = _mm_set1_epi8((char)(first - 1));
+  __m128i hi = _mm_set1_epi8((char)(first + 26));
+  __m128i bit = _mm_set1_epi8(0x20);
+  for (; i + 16 <= l; i += 16) {  /* (bytes above 0x7F are negative) */
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    __m128i m = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+    _mm_storeu_si128((__m128i *)(p + i), _mm_xor_si128(v, _mm_and_si128(m, bit)));
+  }
+#endif
+  for (; i < l; i++) {
+    int c = uchar(s[i]);
+    p[i] = (char)(((unsigned int)(c - first) < 26) ? (c ^ 0x20) : c);
+  }
+}
+
+
 static int str_lower (lua_State *L) {
   size_t l;
   size_t i;
   luaL_Buffer b;
   const char *s = luaL_checklstring(L, 1, &l);
   char *p = luaL_buffinitsize(L, &b, l);
-  for (i=0; i<l; i++)
-    p[i] = tolower(uchar(s[i]));
+  if (clocale())
+    asciicase(p, s, l, 'A');
+  else {
+    for (i=0; i<l; i++)
+      p[i] = tolower(uchar(s[i]));
+  }
   luaL_pushresultsize(&b, l);
   return 1;
 }
@@ -118,8 +169,12 @@ static int str_upper (lua_State *L) {
   luaL_Buffer b;
   const char *s = luaL_checklstring(L, 1, &l);
   char *p = luaL_buffinitsize(L, &b, l);
-  for (i=0; i<l; i++)
-    p[i] = toupper(uchar(s[i]));
+  if (clocale())
+    asciicase(p, s, l, 'a');
+  else {
+    for (i=0; i<l; i++)
+      p[i] = toupper(uchar(s[i]));
+  }
   luaL_pushresultsize(&b, l);
   return 1;
 }
@@ -140,16 +195,20 @@ static int str_rep (lua_State *L) {
     return luaL_error(L, "resulting string too large");
   else {
     size_t totallen = (size_t)n * l + (size_t)(n - 1) * lsep;
+    size_t done;  /* bytes already in the result */
     luaL_Buffer b;
     char *p = luaL_buffinitsize(L, &b, totallen);
-    while (n-- > 1) {  /* first n-1 copies (followed by separator) */
-      memcpy(p, s, l * sizeof(char)); p += l;
-      if (lsep > 0) {  /* empty 'memcpy' is not that cheap */
-        memcpy(p, sep, lsep * sizeof(char));
-        p += lsep;
-      }
+    memcpy(p, s, l * sizeof(char));
+    done = l;
+    if (n > 1 && lsep > 0) {  /* first copy followed by separator */
+      memcpy(p + l, sep, lsep * sizeof(char));
+      done += lsep;
+    }
+    while (done < totallen) {  /* double what is there, up to the end */
+      size_t k = (done < totallen - done) ? done : totallen - done;
+      memcpy(p + done, p, k);
+      done += k;
     }
-    memcpy(p, s, l * sizeof(char));  /* last copy (not followed by separator) */
     luaL_pushresultsize(&b, totallen);
   }
   return 1;
@@ -245,6 +304,7 @@ typedef struct MatchState {
   const char *src_end;  /* end ('\0') of source string */
   const char *p_end;  /* end ('\0') of pattern */
   lua_State *L;
+  const struct PatProg *prog;  /* compiled pattern (NULL to interpret it) */
   int level;  /* total number of captures (finished or unfinished) */
   struct {
     const char *init;
@@ -366,14 +426,9 @@ static int singlematch (MatchState *ms, const char *s, const char *p,
 }
 
 
-static const char *matchbalance (MatchState *ms, const char *s,
-                                   const char *p) {
-  if (p >= ms->p_end - 1)
-    luaL_error(ms->L, "malformed pattern (missing arguments to '%%b')");
-  if (*s != *p) return NULL;
+static const char *balanced (MatchState *ms, const char *s, int b, int e) {
+  if (*s != b) return NULL;
   else {
-    int b = *p;
-    int e = *(p+1);
     int cont = 1;
     while (++s < ms->src_end) {
       if (*s == e) {
@@ -386,6 +441,14 @@ static const char *matchbalance (MatchState *ms, const char *s,
 }
 
 
+static const char *matchbalance (MatchState *ms, const char *s,
+                                   const char *p) {
+  if (p >= ms->p_end - 1)
+    luaL_error(ms->L, "malformed pattern (missing arguments to '%%b')");
+  return balanced(ms, s, *p, *(p+1));
+}
+
+
 static const char *max_expand (MatchState *ms, const char *s,
                                  const char *p, const char *ep) {
   ptrdiff_t i = 0;  /* counts maximum expand for item */
@@ -552,28 +615,584 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 }
 
 
+/*
+** {======================================================
+** Substring search
+** =======================================================
+*/
+
+/*
+** 'lmemfind' looks for places where the first and the last chars of
+** 's2' match (16 places at a time with SSE2) and compares the rest of
+** 's2' only there. Inputs with too many such false candidates (more
+** than FINDBUDGET bytes compared for 'n' places scanned) go on with the
+** Two-Way algorithm, which is linear in the worst case.
+*/
+
+#define FINDBUDGET(n)	(4 * (n) + 256)
+
+/*
+** Two-Way string matching (Crochemore and Perrin, 1991); 's2' has at
+** least 2 chars and no more than 's1'. This is 'twoway_memmem' from
+** musl libc (src/string/memmem.c), which carries this notice:
+**
+** Copyright (C) 2005-2020 Rich Felker, et al.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+static const char *twoway (const char *s1, size_t l1,
+                           const char *s2, size_t l2) {
+  const unsigned char *h = (const unsigned char *)s1;
+  const unsigned char *z = h + l1;
+  const unsigned char *n = (const unsigned char *)s2;
+  size_t i, ip, jp, k, p, ms, p0, mem, mem0;
+  size_t byteset[256 / (8 * sizeof(size_t))] = { 0 };
+  size_t shift[256];
+#define bitop(a,b,op) \
+  ((a)[(size_t)(b) / (8 * sizeof(*(a)))] op \
+     ((size_t)1 << ((size_t)(b) % (8 * sizeof(*(a))))))
+  for (i = 0; i < l2; i++) {  /* bad-char table for the last char */
+    bitop(byteset, n[i], |=);
+    shift[n[i]] = i + 1;
+  }
+  /* maximal suffix for '<' */
+  ip = (size_t)-1; jp = 0; k = p = 1;
+  while (jp + k < l2) {
+    if (n[ip + k] == n[jp + k]) {
+      if (k == p) { jp += p; k = 1; }
+      else k++;
+    }
+    else if (n[ip + k] > n[jp + k]) {
+      jp += k; k = 1; p = jp - ip;
+    }
+    else {
+      ip = jp++; k = p = 1;
+    }
+  }
+  ms = ip;
+  p0 = p;
+  /* maximal suffix for '>' */
+  ip = (size_t)-1; jp = 0; k = p = 1;
+  while (jp + k < l2) {
+    if (n[ip + k] == n[jp + k]) {
+      if (k == p) { jp += p; k = 1; }
+      else k++;
+    }
+    else if (n[ip + k] < n[jp + k]) {
+      jp += k; k = 1; p = jp - ip;
+    }
+    else {
+      ip = jp++; k = p = 1;
+    }
+  }
+  if (ip + 1 > ms + 1) ms = ip;  /* critical factorization */
+  else p = p0;
+  if (memcmp(n, n + p, ms + 1) != 0) {  /* not periodic? */
+    mem0 = 0;
+    p = ((ms > l2 - ms - 1) ? ms : l2 - ms - 1) + 1;
+  }
+  else mem0 = l2 - p;
+  mem = 0;
+  for (;;) {
+    if ((size_t)(z - h) < l2) return NULL;
+    if (bitop(byteset, h[l2 - 1], &)) {
+      k = l2 - shift[h[l2 - 1]];
+      if (k) {
+        if (k < mem) k = mem;
+        h += k;
+        mem = 0;
+        continue;
+      }
+    }
+    else {
+      h += l2;
+      mem = 0;
+      continue;
+    }
+    /* compare right half */
+    for (k = (ms + 1 > mem) ? ms + 1 : mem; k < l2 && n[k] == h[k]; k++) ;
+    if (k < l2) {
+      h += k - ms;
+      mem = 0;
+      continue;
+    }
+    /* compare left half */
+    for (k = ms + 1; k > mem && n[k - 1] == h[k - 1]; k--) ;
+    if (k <= mem) return (const char *)h;
+    h += p;
+    mem = mem0;
+  }
+#undef bitop
+}
+
 
 static const char *lmemfind (const char *s1, size_t l1,
                                const char *s2, size_t l2) {
   if (l2 == 0) return s1;  /* empty strings are everywhere */
   else if (l2 > l1) return NULL;  /* avoids a negative 'l1' */
+  else if (l2 == 1) return (const char *)memchr(s1, *s2, l1);
   else {
-    const char *init;  /* to search for a '*s2' inside 's1' */
-    l2--;  /* 1st char will be checked by 'memchr' */
-    l1 = l1-l2;  /* 's2' cannot be found after that */
-    while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
-      init++;   /* 1st char is already checked */
-      if (memcmp(init, s2+1, l2) == 0)
-        return init-1;
-      else {  /* correct 'l1' and 's1' to try again */
-        l1 -= init-s1;
-        s1 = init;
+    size_t n = l1 - l2 + 1;  /* number of places where 's2' can start */
+    size_t i = 0;
+    size_t work = 0;  /* bytes compared at false candidates */
+    char c1 = s2[0];
+    char c2 = s2[l2 - 1];
+#if defined(LUA_USE_SIMD)
+    __m128i first = _mm_set1_epi8(c1);
+    __m128i last = _mm_set1_epi8(c2);
+    for (; i + 16 <= n; i += 16) {
+      __m128i bf = _mm_loadu_si128((const __m128i *)(s1 + i));
+      __m128i bl = _mm_loadu_si128((const __m128i *)(s1 + i + l2 - 1));
+      unsigned int mask = (unsigned int)_mm_movemask_epi8(
+          _mm_and_si128(_mm_cmpeq_epi8(bf, first), _mm_cmpeq_epi8(bl, last)));
+      while (mask != 0) {
+        const char *init = s1 + i + __builtin_ctz(mask);
+        if (memcmp(init + 1, s2 + 1, l2 - 2) == 0)
+          return init;
+        work += l2;
+        mask &= mask - 1;
+      }
+      if (work > FINDBUDGET(i)) {
+        i += 16;
+        goto slow;
+      }
+    }
+#endif
+    while (i < n) {
+      const char *init = (const char *)memchr(s1 + i, c1, n - i);
+      if (init == NULL) return NULL;
+      i = init - s1 + 1;
+      if (init[l2 - 1] == c2) {
+        if (memcmp(init + 1, s2 + 1, l2 - 2) == 0)
+          return init;
+        work += l2;
+        if (work > FINDBUDGET(i)) goto slow;
       }
     }
     return NULL;  /* not found */
+   slow:
+    if (i >= n) return NULL;
+    return twoway(s1 + i, l1 - i, s2, l2);
   }
 }
 
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Compiled patterns
+** =======================================================
+*/
+
+/*
+** A pattern used more than once is compiled into a sequence of items,
+** one per pattern element, with each single-char class (a char, '.',
+** '%x' or a set) turned into a bitmap of the chars it matches. Leading
+** items that match one fixed char form a prefix, used to skip to the
+** places where a match can start. Compiled programs are kept in a small
+** cache (a table, upvalue of the string functions) indexed by the
+** address of the pattern; as classes are evaluated when a pattern is
+** compiled, a change of locale does not affect programs already in it.
+** Malformed patterns are not compiled, so that errors are raised by
+** 'match' as before.
+*/
+
+/* size of the cache of compiled patterns */
+#define PCACHESIZE	64
+
+/* longer patterns are not compiled */
+#define MAXCOMPILE	128
+
+/* maximum length of the literal prefix of a compiled pattern */
+#define MAXPREFIX	32
+
+/* kinds of items */
+enum { PI_SET, PI_OPEN, PI_POSITION, PI_CLOSE, PI_EOS, PI_BALANCE,
+       PI_FRONTIER, PI_BACKREF, PI_END };
+
+typedef struct PatItem {
+  unsigned char kind;
+  char rep;  /* repetition ('?', '*', '+', '-') of a PI_SET or 0 */
+  char arg[2];  /* delimiters of a '%b', index of a back reference */
+  unsigned char set[32];  /* chars matched by a PI_SET or PI_FRONTIER */
+} PatItem;
+
+typedef struct PatProg {
+  size_t lp;  /* length of the pattern */
+  const char *pat;  /* copy of the pattern (after the items) */
+  size_t lprefix;  /* length of the literal prefix */
+  char prefix[MAXPREFIX];
+  PatItem item[1];  /* items, ended by a PI_END */
+} PatProg;
+
+
+#define inset(it,c)	((it)->set[uchar(c) >> 3] & (1 << (uchar(c) & 7)))
+
+
+/* like 'classend', but returns NULL for a malformed class */
+static const char *classlimit (const char *p, const char *pend) {
+  switch (*p++) {
+    case L_ESC:
+      return (p == pend) ? NULL : p + 1;
+    case '[': {
+      if (*p == '^') p++;
+      do {
+        if (p == pend) return NULL;
+        if (*(p++) == L_ESC && p < pend) p++;
+      } while (*p != ']');
+      return p + 1;
+    }
+    default:
+      return p;
+  }
+}
+
+
+/* fill 'set' with the chars matched by the class [p, ep); return their count */
+static int makeset (unsigned char *set, const char *p, const char *ep) {
+  int c, n = 0;
+  memset(set, 0, 32);
+  for (c = 0; c <= UCHAR_MAX; c++) {
+    int m;
+    switch (*p) {
+      case '.': m = 1; break;
+      case L_ESC: m = match_class(c, uchar(*(p+1))); break;
+      case '[': m = matchbracketclass(c, p, ep-1); break;
+      default: m = (uchar(*p) == c); break;
+    }
+    if (m) {
+      set[c >> 3] |= (unsigned char)(1 << (c & 7));
+      n++;
+    }
+  }
+  return n;
+}
+
+
+/*
+** Compile pattern 'p' (without its anchor) and push the program; push
+** nil and return NULL if the pattern is malformed.
+*/
+static const PatProg *compile (lua_State *L, const char *p, size_t lp) {
+  const char *pend = p + lp;
+  size_t nitems = lp + 1;  /* at most one item per char, plus PI_END */
+  PatProg *prog = (PatProg *)lua_newuserdata(L, sizeof(PatProg) +
+                                      nitems * sizeof(PatItem) + lp);
+  PatItem *it = prog->item;
+  int ncap = 0, open = 0;
+  int inprefix = 1;  /* still in the literal prefix? */
+  prog->lp = lp;
+  prog->pat = (char *)(prog->item + nitems);
+  memcpy((char *)prog->pat, p, lp);
+  prog->lprefix = 0;
+  while (p < pend) {
+    it->rep = 0;
+    switch (*p) {
+      case '(': {
+        if (++ncap > LUA_MAXCAPTURES) goto fail;
+        if (*(p + 1) == ')') {
+          it->kind = PI_POSITION; p += 2;
+        }
+        else {
+          it->kind = PI_OPEN; p++; open++;
+        }
+        break;
+      }
+      case ')': {
+        if (open-- == 0) goto fail;  /* invalid pattern capture */
+        it->kind = PI_CLOSE; p++;
+        break;
+      }
+      case '$': {
+        if (p + 1 != pend) goto dflt;
+        it->kind = PI_EOS; p++;
+        break;
+      }
+      case L_ESC: {
+        switch (*(p + 1)) {
+          case 'b': {
+            if (p + 2 >= pend - 1) goto fail;
+            it->kind = PI_BALANCE;
+            it->arg[0] = p[2]; it->arg[1] = p[3];
+            p += 4;
+            break;
+          }
+          case 'f': {
+            const char *ep;
+            p += 2;
+            if (*p != '[' || (ep = classlimit(p, pend)) == NULL) goto fail;
+            it->kind = PI_FRONTIER;
+            makeset(it->set, p, ep);
+            p = ep;
+            break;
+          }
+          case '0': case '1': case '2': case '3':
+          case '4': case '5': case '6': case '7':
+          case '8': case '9': {
+            it->kind = PI_BACKREF;
+            it->arg[0] = p[1];
+            p += 2;
+            break;
+          }
+          default: goto dflt;
+        }
+        break;
+      }
+      default: dflt: {
+        const char *ep = classlimit(p, pend);
+        int n;
+        if (ep == NULL) goto fail;
+        it->kind = PI_SET;
+        n = makeset(it->set, p, ep);
+        if (ep < pend && (*ep == '?' || *ep == '*' || *ep == '+' ||
+                          *ep == '-'))
+          it->rep = *ep++;
+        p = ep;
+        if (inprefix && n == 1 && it->rep == 0 &&
+            prog->lprefix < MAXPREFIX) {  /* one more char in the prefix? */
+          int c = 0;
+          while (!inset(it, c)) c++;
+          prog->prefix[prog->lprefix++] = (char)c;
+          it++;
+          continue;
+        }
+        break;
+      }
+    }
+    inprefix = 0;
+    it++;
+  }
+  it->kind = PI_END;
+  return prog;
+ fail:
+  lua_pop(L, 1);
+  lua_pushnil(L);
+  return NULL;
+}
+
+
+/*
+** Push the compiled program for pattern 'p' (without its anchor) kept
+** in cache 'cache', compiling it if needed; push nil and return NULL
+** if the pattern should be interpreted. A pattern is compiled only the
+** second time it is seen, so that patterns built on the fly do not pay
+** for it.
+*/
+static const PatProg *getprog (lua_State *L, int cache, const char *p,
+                                                        size_t lp) {
+  int slot = (int)((((size_t)p >> 3) ^ lp) % PCACHESIZE) + 1;
+  if (lp > MAXCOMPILE) {
+    lua_pushnil(L);
+    return NULL;
+  }
+  if (lua_rawgeti(L, cache, slot) == LUA_TUSERDATA) {
+    const PatProg *prog = (const PatProg *)lua_touserdata(L, -1);
+    if (prog->lp == lp && memcmp(prog->pat, p, lp) == 0)
+      return prog;  /* cache hit */
+  }
+  if (lua_touserdata(L, -1) != (void *)p) {  /* not seen before? */
+    lua_pushlightuserdata(L, (void *)p);
+    lua_rawseti(L, cache, slot);  /* compile it next time */
+    return NULL;
+  }
+  lua_pop(L, 1);
+  if (compile(L, p, lp) == NULL)
+    return NULL;
+  lua_pushvalue(L, -1);
+  lua_rawseti(L, cache, slot);
+  return (const PatProg *)lua_touserdata(L, -1);
+}
+
+
+static const char *cmatch (MatchState *ms, const char *s, const PatItem *it);
+
+
+static const char *cmax_expand (MatchState *ms, const char *s,
+                                const PatItem *it) {
+  ptrdiff_t i = 0;
+  ptrdiff_t n = ms->src_end - s;
+  while (i < n && inset(it, s[i]))
+    i++;
+  while (i >= 0) {
+    const char *res = cmatch(ms, s + i, it + 1);
+    if (res) return res;
+    i--;
+  }
+  return NULL;
+}
+
+
+static const char *cmin_expand (MatchState *ms, const char *s,
+                                const PatItem *it) {
+  for (;;) {
+    const char *res = cmatch(ms, s, it + 1);
+    if (res != NULL)
+      return res;
+    else if (s < ms->src_end && inset(it, *s))
+      s++;
+    else return NULL;
+  }
+}
+
+
+static const char *cstart_capture (MatchState *ms, const char *s,
+                                   const PatItem *it, int what) {
+  const char *res;
+  int level = ms->level;
+  if (level >= LUA_MAXCAPTURES) luaL_error(ms->L, "too many captures");
+  ms->capture[level].init = s;
+  ms->capture[level].len = what;
+  ms->level = level+1;
+  if ((res = cmatch(ms, s, it)) == NULL)
+    ms->level--;
+  return res;
+}
+
+
+static const char *cend_capture (MatchState *ms, const char *s,
+                                 const PatItem *it) {
+  int l = capture_to_close(ms);
+  const char *res;
+  ms->capture[l].len = s - ms->capture[l].init;
+  if ((res = cmatch(ms, s, it)) == NULL)
+    ms->capture[l].len = CAP_UNFINISHED;
+  return res;
+}
+
+
+/* 'match' over a compiled program */
+static const char *cmatch (MatchState *ms, const char *s, const PatItem *it) {
+  if (ms->matchdepth-- == 0)
+    luaL_error(ms->L, "pattern too complex");
+  init:
+  switch (it->kind) {
+    case PI_END: break;
+    case PI_OPEN: {
+      s = cstart_capture(ms, s, it + 1, CAP_UNFINISHED);
+      break;
+    }
+    case PI_POSITION: {
+      s = cstart_capture(ms, s, it + 1, CAP_POSITION);
+      break;
+    }
+    case PI_CLOSE: {
+      s = cend_capture(ms, s, it + 1);
+      break;
+    }
+    case PI_EOS: {
+      s = (s == ms->src_end) ? s : NULL;
+      break;
+    }
+    case PI_BALANCE: {
+      s = balanced(ms, s, it->arg[0], it->arg[1]);
+      if (s != NULL) {
+        it++; goto init;
+      }
+      break;
+    }
+    case PI_FRONTIER: {
+      char previous = (s == ms->src_init) ? '\0' : *(s - 1);
+      if (!inset(it, previous) && inset(it, *s)) {
+        it++; goto init;
+      }
+      s = NULL;
+      break;
+    }
+    case PI_BACKREF: {
+      s = match_capture(ms, s, uchar(it->arg[0]));
+      if (s != NULL) {
+        it++; goto init;
+      }
+      break;
+    }
+    default: {  /* PI_SET */
+      if (s >= ms->src_end || !inset(it, *s)) {
+        if (it->rep == '*' || it->rep == '?' || it->rep == '-') {
+          it++; goto init;
+        }
+        s = NULL;
+      }
+      else {
+        switch (it->rep) {
+          case '?': {
+            const char *res;
+            if ((res = cmatch(ms, s + 1, it + 1)) != NULL)
+              s = res;
+            else {
+              it++; goto init;
+            }
+            break;
+          }
+          case '+':
+            s++;
+            /* FALLTHROUGH */
+          case '*':
+            s = cmax_expand(ms, s, it);
+            break;
+          case '-':
+            s = cmin_expand(ms, s, it);
+            break;
+          default:
+            s++; it++; goto init;
+        }
+      }
+      break;
+    }
+  }
+  ms->matchdepth++;
+  return s;
+}
+
+
+/* try to match at 's', with the compiled program if there is one */
+static const char *domatch (MatchState *ms, const char *s, const char *p) {
+  const PatProg *prog = ms->prog;
+  if (prog == NULL)
+    return match(ms, s, p);
+  else {
+    size_t n = prog->lprefix;
+    if (n > 0) {
+      if ((size_t)(ms->src_end - s) < n || memcmp(s, prog->prefix, n) != 0)
+        return NULL;
+      s += n;
+    }
+    return cmatch(ms, s, prog->item + n);
+  }
+}
+
+
+/* first position from 's' where a match can start (NULL if none) */
+static const char *skipto (MatchState *ms, const char *s) {
+  const PatProg *prog = ms->prog;
+  if (prog == NULL || prog->lprefix == 0)
+    return s;
+  else if (s >= ms->src_end)
+    return NULL;
+  else
+    return lmemfind(s, ms->src_end - s, prog->prefix, prog->lprefix);
+}
+
+/* }====================================================== */
+
+
 
 static void push_onecapture (MatchState *ms, int i, const char *s,
                                                     const char *e) {
@@ -644,6 +1263,7 @@ static int str_find_aux (lua_State *L, int find) {
       p++; lp--;  /* skip anchor character */
     }
     ms.L = L;
+    ms.prog = getprog(L, lua_upvalueindex(1), p, lp);
     ms.matchdepth = MAXCCALLS;
     ms.src_init = s;
     ms.src_end = s + ls;
@@ -652,7 +1272,9 @@ static int str_find_aux (lua_State *L, int find) {
       const char *res;
       ms.level = 0;
       lua_assert(ms.matchdepth == MAXCCALLS);
-      if ((res=match(&ms, s1, p)) != NULL) {
+      if (!anchor && (s1 = skipto(&ms, s1)) == NULL)
+        break;  /* no more places where it can match */
+      if ((res=domatch(&ms, s1, p)) != NULL) {
         if (find) {
           lua_pushinteger(L, s1 - s + 1);  /* start */
           lua_pushinteger(L, res - s);   /* end */
@@ -685,6 +1307,7 @@ static int gmatch_aux (lua_State *L) {
   const char *p = lua_tolstring(L, lua_upvalueindex(2), &lp);
   const char *src;
   ms.L = L;
+  ms.prog = getprog(L, lua_upvalueindex(4), p, lp);
   ms.matchdepth = MAXCCALLS;
   ms.src_init = s;
   ms.src_end = s+ls;
@@ -695,7 +1318,9 @@ static int gmatch_aux (lua_State *L) {
     const char *e;
     ms.level = 0;
     lua_assert(ms.matchdepth == MAXCCALLS);
-    if ((e = match(&ms, src, p)) != NULL) {
+    if ((src = skipto(&ms, src)) == NULL)
+      break;
+    if ((e = domatch(&ms, src, p)) != NULL) {
       lua_Integer newstart = e-s;
       if (e == src) newstart++;  /* empty match? go at least one position */
       lua_pushinteger(L, newstart);
@@ -712,7 +1337,8 @@ static int gmatch (lua_State *L) {
   luaL_checkstring(L, 2);
   lua_settop(L, 2);
   lua_pushinteger(L, 0);
-  lua_pushcclosure(L, gmatch_aux, 3);
+  lua_pushvalue(L, lua_upvalueindex(1));  /* pattern cache */
+  lua_pushcclosure(L, gmatch_aux, 4);
   return 1;
 }
 
@@ -789,10 +1415,11 @@ static int str_gsub (lua_State *L) {
   luaL_argcheck(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                    tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                       "string/function/table expected");
-  luaL_buffinit(L, &b);
   if (anchor) {
     p++; lp--;  /* skip anchor character */
   }
+  ms.prog = getprog(L, lua_upvalueindex(1), p, lp);
+  luaL_buffinit(L, &b);
   ms.L = L;
   ms.matchdepth = MAXCCALLS;
   ms.src_init = src;
@@ -802,7 +1429,13 @@ static int str_gsub (lua_State *L) {
     const char *e;
     ms.level = 0;
     lua_assert(ms.matchdepth == MAXCCALLS);
-    e = match(&ms, src, p);
+    if (!anchor) {
+      const char *c = skipto(&ms, src);
+      if (c == NULL) break;  /* no more matches */
+      luaL_addlstring(&b, src, c - src);
+      src = c;
+    }
+    e = domatch(&ms, src, p);
     if (e) {
       n++;
       add_value(&ms, &b, src, e, tr);
@@ -820,6 +1453,122 @@ static int str_gsub (lua_State *L) {
   return 2;
 }
 
+
+/* fields of 's' separated by the plain string 'sep', at most 'limit' */
+static void splitplain (lua_State *L, const char *s, size_t ls,
+                        const char *sep, size_t lsep, lua_Integer limit) {
+  const char *e = s + ls;
+  const char *q = s;
+  lua_Integer n = 1;  /* number of fields */
+  lua_Integer i;
+  while (n < limit && (q = lmemfind(q, e - q, sep, lsep)) != NULL) {
+    n++;
+    q += lsep;
+  }
+  lua_createtable(L, (n <= INT_MAX) ? (int)n : 0, 0);
+  for (i = 1; i < n; i++) {
+    q = lmemfind(s, e - s, sep, lsep);
+    lua_pushlstring(L, s, q - s);
+    lua_rawseti(L, -2, i);
+    s = q + lsep;
+  }
+  lua_pushlstring(L, s, e - s);
+  lua_rawseti(L, -2, n);
+}
+
+
+/*
+** fields of 's' separated by non-empty matches of pattern 'p' (which,
+** as in 'gmatch', is not anchored by a '^'), at most 'limit'
+*/
+static void splitpattern (lua_State *L, const char *s, size_t ls,
+                          const char *p, size_t lp, lua_Integer limit) {
+  MatchState ms;
+  const char *start = s;  /* start of current field */
+  const char *src = s;
+  lua_Integer n = 0;
+  ms.L = L;
+  ms.prog = getprog(L, lua_upvalueindex(1), p, lp);
+  ms.matchdepth = MAXCCALLS;
+  ms.src_init = s;
+  ms.src_end = s + ls;
+  ms.p_end = p + lp;
+  lua_newtable(L);
+  while (n + 1 < limit) {
+    const char *e = NULL;
+    for (;;) {  /* look for a non-empty match from 'src' */
+      ms.level = 0;
+      lua_assert(ms.matchdepth == MAXCCALLS);
+      if ((src = skipto(&ms, src)) == NULL) break;
+      if ((e = domatch(&ms, src, p)) != NULL && e > src) break;
+      e = NULL;
+      if (src++ >= ms.src_end) break;
+    }
+    if (e == NULL) break;  /* no more separators */
+    lua_pushlstring(L, start, src - start);
+    lua_rawseti(L, -2, ++n);
+    start = src = e;
+  }
+  lua_pushlstring(L, start, ms.src_end - start);
+  lua_rawseti(L, -2, n + 1);
+}
+
+
+/*
+** string.split(s, sep [, plain [, limit]]): table with the fields of
+** 's' separated by 'sep', a pattern unless 'plain' is true or it has
+** no special characters; with a 'limit', the last of the 'limit'
+** fields gets the rest of 's'.
+*/
+static int str_split (lua_State *L) {
+  size_t ls, lsep;
+  const char *s = luaL_checklstring(L, 1, &ls);
+  const char *sep = luaL_checklstring(L, 2, &lsep);
+  lua_Integer limit = luaL_optinteger(L, 4, LUA_MAXINTEGER);
+  luaL_argcheck(L, lsep > 0, 2, "empty separator");
+  luaL_argcheck(L, limit > 0, 4, "limit must be positive");
+  if (lua_toboolean(L, 3) || nospecials(sep, lsep))
+    splitplain(L, s, ls, sep, lsep, limit);
+  else
+    splitpattern(L, s, ls, sep, lsep, limit);
+  return 1;
+}
+
+
+static int fields_aux (lua_State *L) {
+  size_t ls;
+  const char *s = lua_tolstring(L, lua_upvalueindex(1), &ls);
+  int c = (int)lua_tointeger(L, lua_upvalueindex(2));
+  size_t pos = (size_t)lua_tointeger(L, lua_upvalueindex(3));
+  const char *q;
+  if (pos > ls) return 0;  /* no more fields */
+  q = (const char *)memchr(s + pos, c, ls - pos);
+  if (q == NULL) q = s + ls;  /* last field */
+  lua_pushlstring(L, s + pos, q - (s + pos));
+  lua_pushinteger(L, q - s + 1);
+  lua_replace(L, lua_upvalueindex(3));
+  return 1;
+}
+
+
+/*
+** string.fields(s, c): iterator over the fields of 's' separated by
+** the char 'c' (an empty 's' has one empty field)
+*/
+static int str_fields (lua_State *L) {
+  size_t lc;
+  const char *c;
+  luaL_checkstring(L, 1);
+  c = luaL_checklstring(L, 2, &lc);
+  luaL_argcheck(L, lc == 1, 2, "single-char separator expected");
+  lua_pushinteger(L, uchar(*c));
+  lua_replace(L, 2);
+  lua_settop(L, 2);
+  lua_pushinteger(L, 0);
+  lua_pushcclosure(L, fields_aux, 3);
+  return 1;
+}
+
 /* }====================================================== */
 
 
@@ -907,6 +1656,76 @@ static void addlenmod (char *form, const char *lenmod) {
   form[l + lm] = '\0';
 }
 
+/*
+** Direct formatting of the most common items, giving the same bytes as
+** 'sprintf' would with 'form' (before 'addlenmod'). They return -1 for
+** the forms they do not handle.
+*/
+
+/* '%d', '%i', '%x' and '%X' with an optional '-' or '0' flag and width */
+static int fmtint (char *buff, const char *form, lua_Integer n) {
+  char digs[3 * sizeof(lua_Integer)];
+  const char *d;  /* digits */
+  const char *f = form + 1;
+  int left = 0, zero = 0, width = 0, len, neg = 0;
+  int nb = 0;
+  if (*f == '-') { left = 1; f++; }
+  else if (*f == '0') { zero = 1; f++; }
+  while (isdigit(uchar(*f)))
+    width = width * 10 + (*f++ - '0');
+  if (f[1] != '\0') return -1;
+  switch (*f) {
+    case 'd': case 'i': {
+      len = lua_integer2buff(digs, n);
+      d = digs;
+      if (n < 0) {  /* sign goes before the padding zeros */
+        neg = 1;
+        d++; len--;
+      }
+      break;
+    }
+    case 'x': case 'X': {
+      const char *hex = (*f == 'x') ? "0123456789abcdef" : "0123456789ABCDEF";
+      lua_Unsigned u = (lua_Unsigned)n;
+      char *e = digs + sizeof(digs);
+      do {
+        *--e = hex[u & 15];
+        u >>= 4;
+      } while (u != 0);
+      d = e;
+      len = (int)(digs + sizeof(digs) - e);
+      break;
+    }
+    default: return -1;
+  }
+  width -= neg + len;  /* now, amount of padding */
+  if (!left && !zero)
+    for (; width > 0; width--) buff[nb++] = ' ';
+  if (neg) buff[nb++] = '-';
+  if (zero)
+    for (; width > 0; width--) buff[nb++] = '0';
+  memcpy(buff + nb, d, len);
+  nb += len;
+  for (; width > 0; width--) buff[nb++] = ' ';
+  return nb;
+}
+
+
+/* '%f' and '%.Nf' (conversion itself is done by 'lua_fixed2buff') */
+static int fmtfixed (char *buff, const char *form, lua_Number x) {
+  const char *f = form + 1;
+  int prec = 6;
+  int nb;
+  if (*f == '.') {
+    for (prec = 0, f++; isdigit(uchar(*f)); f++)
+      prec = prec * 10 + (*f - '0');
+  }
+  if (*f != 'f' || f[1] != '\0') return -1;
+  nb = lua_fixed2buff(buff, x, prec);
+  return (nb > 0) ? nb : -1;
+}
+
+
 /**
  * sting.format 实现
  */
@@ -938,8 +1757,10 @@ static int str_format (lua_State *L) {
         case 'd': case 'i':
         case 'o': case 'u': case 'x': case 'X': {
           lua_Integer n = luaL_checkinteger(L, arg);
-          addlenmod(form, LUA_INTEGER_FRMLEN);
-          nb = sprintf(buff, form, n);
+          if ((nb = fmtint(buff, form, n)) < 0) {
+            addlenmod(form, LUA_INTEGER_FRMLEN);
+            nb = sprintf(buff, form, n);
+          }
           break;
         }
 #if defined(LUA_USE_AFORMAT)
@@ -947,8 +1768,11 @@ static int str_format (lua_State *L) {
 #endif
         case 'e': case 'E': case 'f':
         case 'g': case 'G': {
-          addlenmod(form, LUA_NUMBER_FRMLEN);
-          nb = sprintf(buff, form, luaL_checknumber(L, arg));
+          lua_Number n = luaL_checknumber(L, arg);
+          if ((nb = fmtfixed(buff, form, n)) < 0) {
+            addlenmod(form, LUA_NUMBER_FRMLEN);
+            nb = sprintf(buff, form, n);
+          }
           break;
         }
         case 'q': {
@@ -964,6 +1788,12 @@ static int str_format (lua_State *L) {
             luaL_addvalue(&b);
             break;
           }
+          else if (form[2] == '\0') {  /* plain '%s'? copy up to a '\0' */
+            nb = (int)strlen(s);
+            memcpy(buff, s, nb);
+            lua_pop(L, 1);
+            break;
+          }
           else {
             nb = sprintf(buff, form, s);
             lua_pop(L, 1);  /* remove result from 'luaL_tolstring' */
@@ -1149,15 +1979,15 @@ static KOption getoption (Header *h, const char **fmt, int *size) {
 
 /*
 ** Read, classify, and fill other details about the next option.
-** 'psize' is filled with option's size, 'notoalign' with its
-** alignment requirements.
-** Local variable 'size' gets the size to be aligned. (Kpadal option
+** 'psize' is filled with option's size, 'palign' with its
+** alignment requirements (1 if it needs none).
+** Local variable 'align' gets the size to be aligned. (Kpadal option
 ** always gets its full alignment, other options are limited by 
 ** the maximum alignment ('maxalign'). Kchar option needs no alignment
 ** despite its size.
 */
-static KOption getdetails (Header *h, size_t totalsize,
-                           const char **fmt, int *psize, int *ntoalign) {
+static KOption getalign (Header *h, const char **fmt,
+                         int *psize, int *palign) {
   KOption opt = getoption(h, fmt, psize);
   int align = *psize;  /* usually, alignment follows size */
   if (opt == Kpaddalign) {  /* 'X' gets alignment from following option */
@@ -1165,14 +1995,32 @@ static KOption getdetails (Header *h, size_t totalsize,
       luaL_argerror(h->L, 1, "invalid next option for option 'X'");
   }
   if (align <= 1 || opt == Kchar)  /* need no alignment? */
-    *ntoalign = 0;
+    align = 1;
   else {
     if (align > h->maxalign)  /* enforce maximum alignment */
       align = h->maxalign;
     if ((align & (align - 1)) != 0)  /* is 'align' not a power of 2? */
       luaL_argerror(h->L, 1, "format asks for alignment not power of 2");
-    *ntoalign = (align - (int)(totalsize & (align - 1))) & (align - 1);
   }
+  *palign = align;
+  return opt;
+}
+
+
+/* padding needed to align position 'pos' to 'align' (a power of 2) */
+#define padfor(pos,align)  \
+	((int)(((align) - ((pos) & ((align) - 1))) & ((align) - 1)))
+
+
+/*
+** Read the next option like 'getalign', but give in 'ntoalign' the
+** padding it needs at position 'totalsize'.
+*/
+static KOption getdetails (Header *h, size_t totalsize,
+                           const char **fmt, int *psize, int *ntoalign) {
+  int align;
+  KOption opt = getalign(h, fmt, psize, &align);
+  *ntoalign = padfor(totalsize, (size_t)align);
   return opt;
 }
 
@@ -1424,13 +2272,509 @@ static int str_unpack (lua_State *L) {
   return n + 1;
 }
 
+
+/*
+** Compiled formats. 'string.packer(fmt)' parses 'fmt' once into a
+** list of items, and its methods pack or unpack with that list: one
+** record at a time like 'string.pack'/'string.unpack', or many records
+** at once, taking values from or giving them in one table per value
+** item ("column"). Alignment of each item is kept, not its padding,
+** as the padding depends on the position where it goes.
+*/
+
+#define LUA_PACKERHANDLE	"PACKER*"
+
+typedef struct PackItem {
+  int kind;  /* a KOption */
+  int size;  /* size of the option (or of its length, for Kstring) */
+  int align;  /* alignment requirement (1 for none) */
+  int islittle;  /* endianness */
+} PackItem;
+
+typedef struct Packer {
+  int nitem;  /* number of items */
+  int nvalue;  /* number of items that take a value */
+  int fixed;  /* true iff there are no variable-length items */
+  size_t minsize;  /* minimum size of a record (without padding) */
+  PackItem item[1];  /* items (actually 'nitem' of them) */
+} Packer;
+
+
+#define topacker(L)	((Packer *)luaL_checkudata(L, 1, LUA_PACKERHANDLE))
+
+
+static int packer_new (lua_State *L) {
+  size_t lf;
+  const char *fmt = luaL_checklstring(L, 1, &lf);
+  /* each item uses at least one character of 'fmt' */
+  Packer *pk = (Packer *)lua_newuserdata(L, offsetof(Packer, item) +
+                                            (lf + 1) * sizeof(PackItem));
+  Header h;
+  pk->nitem = pk->nvalue = 0;
+  pk->fixed = 1;
+  pk->minsize = 0;
+  initheader(L, &h);
+  while (*fmt != '\0') {
+    int size, align;
+    KOption opt = getalign(&h, &fmt, &size, &align);
+    PackItem *it = &pk->item[pk->nitem];
+    if (opt == Knop) continue;
+    it->kind = opt;
+    it->size = size;
+    it->align = align;
+    it->islittle = h.islittle;
+    pk->nitem++;
+    if (opt != Kpadding && opt != Kpaddalign)
+      pk->nvalue++;
+    if (opt == Kstring || opt == Kzstr) {
+      pk->fixed = 0;
+      if (opt == Kzstr) size = 1;  /* at least the final '\0' */
+    }
+    pk->minsize += size;
+  }
+  luaL_setmetatable(L, LUA_PACKERHANDLE);
+  return 1;
+}
+
+
+/* error message for a value at 'arg' of the wrong type */
+static const char *packtypeerror (lua_State *L, int arg, const char *tname) {
+  return lua_pushfstring(L, "%s expected, got %s",
+                            tname, luaL_typename(L, arg));
+}
+
+
+/*
+** Pack the value at index 'arg' as item 'it', after padding for its
+** alignment. Return NULL, or a message if the value is not valid for
+** the item. Neither this nor the error path leave anything on the
+** stack above the buffer, except for the message itself.
+*/
+static const char *packitem (lua_State *L, luaL_Buffer *b,
+                             const PackItem *it, int arg, size_t *total) {
+  int size = it->size;
+  int ntoalign = padfor(*total, (size_t)it->align);
+  *total += ntoalign + size;
+  while (ntoalign-- > 0)
+    luaL_addchar(b, LUA_PACKPADBYTE);  /* fill alignment */
+  switch ((KOption)it->kind) {
+    case Kint: case Kuint: {
+      int isnum;
+      lua_Integer n = lua_tointegerx(L, arg, &isnum);
+      if (!isnum)
+        return lua_isnumber(L, arg) ? "number has no integer representation"
+                                    : packtypeerror(L, arg, "number");
+      if (size < SZINT) {  /* need overflow check? */
+        if (it->kind == Kint) {
+          lua_Integer lim = (lua_Integer)1 << ((size * NB) - 1);
+          if (!(-lim <= n && n < lim)) return "integer overflow";
+        }
+        else if ((lua_Unsigned)n >= ((lua_Unsigned)1 << (size * NB)))
+          return "unsigned overflow";
+      }
+      packint(b, (lua_Unsigned)n, it->islittle, size,
+                 (it->kind == Kint && n < 0));
+      break;
+    }
+    case Kfloat: {
+      volatile Ftypes u;
+      char *buff;
+      int isnum;
+      lua_Number n = lua_tonumberx(L, arg, &isnum);
+      if (!isnum) return packtypeerror(L, arg, "number");
+      buff = luaL_prepbuffsize(b, size);
+      if (size == sizeof(u.f)) u.f = (float)n;  /* copy it into 'u' */
+      else if (size == sizeof(u.d)) u.d = (double)n;
+      else u.n = n;
+      copywithendian(buff, u.buff, size, it->islittle);
+      luaL_addsize(b, size);
+      break;
+    }
+    case Kchar: case Kstring: case Kzstr: {
+      size_t len;
+      const char *s = lua_tolstring(L, arg, &len);
+      if (s == NULL) return packtypeerror(L, arg, "string");
+      if (it->kind == Kchar) {
+        if (len != (size_t)size) return "wrong length";
+        luaL_addlstring(b, s, len);
+      }
+      else if (it->kind == Kstring) {
+        if (!(size >= (int)sizeof(size_t) ||
+              len < ((size_t)1 << (size * NB))))
+          return "string length does not fit in given size";
+        packint(b, (lua_Unsigned)len, it->islittle, size, 0);
+        luaL_addlstring(b, s, len);
+        *total += len;
+      }
+      else {
+        if (strlen(s) != len) return "string contains zeros";
+        luaL_addlstring(b, s, len);
+        luaL_addchar(b, '\0');
+        *total += len + 1;
+      }
+      break;
+    }
+    case Kpadding:
+      luaL_addchar(b, LUA_PACKPADBYTE);
+      break;
+    default: break;  /* Kpaddalign: only the alignment */
+  }
+  return NULL;
+}
+
+
+/*
+** Unpack item 'it' from 'data' at position '*pos', pushing its value
+** (if it has one) and advancing '*pos' past it.
+*/
+static void unpackitem (lua_State *L, const char *data, size_t ld,
+                        const PackItem *it, size_t *pos) {
+  size_t p = *pos;
+  int size = it->size;
+  int ntoalign = padfor(p, (size_t)it->align);
+  if ((size_t)ntoalign + size > ~p || p + ntoalign + size > ld)
+    luaL_argerror(L, 2, "data string too short");
+  p += ntoalign;  /* skip alignment */
+  switch ((KOption)it->kind) {
+    case Kint: case Kuint:
+      lua_pushinteger(L, unpackint(L, data + p, it->islittle, size,
+                                      (it->kind == Kint)));
+      break;
+    case Kfloat: {
+      volatile Ftypes u;
+      lua_Number num;
+      copywithendian(u.buff, data + p, size, it->islittle);
+      if (size == sizeof(u.f)) num = (lua_Number)u.f;
+      else if (size == sizeof(u.d)) num = (lua_Number)u.d;
+      else num = u.n;
+      lua_pushnumber(L, num);
+      break;
+    }
+    case Kchar:
+      lua_pushlstring(L, data + p, size);
+      break;
+    case Kstring: {
+      size_t len = (size_t)unpackint(L, data + p, it->islittle, size, 0);
+      luaL_argcheck(L, len <= ld - p - size, 2, "data string too short");
+      lua_pushlstring(L, data + p + size, len);
+      p += len;  /* skip string */
+      break;
+    }
+    case Kzstr: {
+      size_t len = strlen(data + p);
+      luaL_argcheck(L, p + len < ld, 2, "unfinished string for format 'z'");
+      lua_pushlstring(L, data + p, len);
+      p += len + 1;  /* skip string plus final '\0' */
+      break;
+    }
+    default: break;  /* Kpadding, Kpaddalign */
+  }
+  *pos = p + size;
+}
+
+
+static int packer_pack (lua_State *L) {
+  Packer *pk = topacker(L);
+  luaL_Buffer b;
+  size_t total = 0;
+  int top = lua_gettop(L);  /* last argument */
+  int arg = 1;  /* current argument to pack */
+  int i;
+  lua_pushnil(L);  /* mark to separate arguments from string buffer */
+  luaL_buffinit(L, &b);
+  for (i = 0; i < pk->nitem; i++) {
+    const PackItem *it = &pk->item[i];
+    const char *msg;
+    if (it->kind != Kpadding && it->kind != Kpaddalign) {
+      if (++arg > top)  /* missing argument? (not the mark or the buffer) */
+        luaL_argerror(L, arg, lua_pushfstring(L, "%s expected, got no value",
+                                 (it->kind <= Kfloat) ? "number" : "string"));
+    }
+    if ((msg = packitem(L, &b, it, arg, &total)) != NULL)
+      luaL_argerror(L, arg, msg);
+  }
+  luaL_pushresult(&b);
+  return 1;
+}
+
+
+static int packer_unpack (lua_State *L) {
+  Packer *pk = topacker(L);
+  size_t ld;
+  const char *data = luaL_checklstring(L, 2, &ld);
+  size_t pos = (size_t)posrelat(luaL_optinteger(L, 3, 1), ld) - 1;
+  int i;
+  luaL_argcheck(L, pos <= ld, 3, "initial position out of string");
+  luaL_checkstack(L, pk->nvalue + 1, "too many results");
+  for (i = 0; i < pk->nitem; i++)
+    unpackitem(L, data, ld, &pk->item[i], &pos);
+  lua_pushinteger(L, pos + 1);  /* next position */
+  return pk->nvalue + 1;
+}
+
+
+/*
+** packer:packmany(col1, ..., colK [, n]): pack records 1 to 'n'
+** (default '#col1'), taking the value of the k-th value item of
+** record 'i' from 'colk[i]', into one string.
+*/
+static int packer_packmany (lua_State *L) {
+  Packer *pk = topacker(L);
+  int nv = pk->nvalue;
+  lua_Integer n, r;
+  luaL_Buffer b;
+  size_t total = 0;
+  int slot, i;
+  for (i = 2; i <= nv + 1; i++)
+    luaL_checktype(L, i, LUA_TTABLE);
+  n = luaL_optinteger(L, nv + 2, (nv > 0) ? (lua_Integer)lua_rawlen(L, 2) : 0);
+  luaL_argcheck(L, n >= 0, nv + 2, "invalid number of records");
+  lua_settop(L, nv + 1);
+  lua_pushnil(L);  /* slot for the current value, below the buffer */
+  slot = lua_gettop(L);
+  luaL_buffinit(L, &b);
+  for (r = 1; r <= n; r++) {
+    int col = 1;
+    for (i = 0; i < pk->nitem; i++) {
+      const PackItem *it = &pk->item[i];
+      const char *msg;
+      if (it->kind != Kpadding && it->kind != Kpaddalign) {
+        lua_rawgeti(L, ++col, r);
+        lua_replace(L, slot);  /* keep the buffer at the top */
+      }
+      if ((msg = packitem(L, &b, it, slot, &total)) != NULL)
+        luaL_error(L, "bad value #%I in column %d (%s)",
+                      r, col - 1, msg);
+    }
+  }
+  luaL_pushresult(&b);
+  return 1;
+}
+
+
+/*
+** packer:unpackmany(s [, pos [, n]]): unpack 'n' records from 's'
+** starting at 'pos' (default 1), or all records up to the end of 's'
+** if 'n' is absent. Return one table per value item with the values
+** of that item, followed by the position after the last record.
+*/
+static int packer_unpackmany (lua_State *L) {
+  Packer *pk = topacker(L);
+  size_t ld;
+  const char *data = luaL_checklstring(L, 2, &ld);
+  size_t pos = (size_t)posrelat(luaL_optinteger(L, 3, 1), ld) - 1;
+  lua_Integer n = luaL_optinteger(L, 4, -1);
+  lua_Integer r;
+  int hint = 0;  /* expected number of records */
+  int base, i;
+  luaL_argcheck(L, pos <= ld, 3, "initial position out of string");
+  if (n < 0) {
+    luaL_argcheck(L, lua_isnoneornil(L, 4), 4, "invalid number of records");
+    if (pk->minsize == 0)
+      luaL_argerror(L, 1, "format has no data; number of records needed");
+    if (pk->fixed)
+      hint = ((ld - pos) / pk->minsize > INT_MAX) ? INT_MAX
+                                 : (int)((ld - pos) / pk->minsize);
+  }
+  else
+    hint = (n > INT_MAX) ? INT_MAX : (int)n;
+  luaL_checkstack(L, pk->nvalue + 2, "too many results");
+  lua_settop(L, 2);  /* keep the data string */
+  base = lua_gettop(L);
+  for (i = 0; i < pk->nvalue; i++)
+    lua_createtable(L, hint, 0);
+  for (r = 1; (n < 0) ? pos < ld : r <= n; r++) {
+    int col = base;
+    for (i = 0; i < pk->nitem; i++) {
+      const PackItem *it = &pk->item[i];
+      unpackitem(L, data, ld, it, &pos);
+      if (it->kind != Kpadding && it->kind != Kpaddalign)
+        lua_rawseti(L, ++col, r);
+    }
+  }
+  lua_pushinteger(L, pos + 1);  /* next position */
+  return pk->nvalue + 1;
+}
+
+
+/* packer:size(): size of a record, like 'string.packsize' */
+static int packer_size (lua_State *L) {
+  Packer *pk = topacker(L);
+  size_t total = 0;
+  int i;
+  luaL_argcheck(L, pk->fixed, 1, "variable-length format");
+  for (i = 0; i < pk->nitem; i++) {
+    const PackItem *it = &pk->item[i];
+    size_t size = (size_t)padfor(total, (size_t)it->align) + it->size;
+    luaL_argcheck(L, total <= MAXSIZE - size, 1, "format result too large");
+    total += size;
+  }
+  lua_pushinteger(L, (lua_Integer)total);
+  return 1;
+}
+
+
+static const luaL_Reg packerlib[] = {
+  {"pack", packer_pack},
+  {"packmany", packer_packmany},
+  {"size", packer_size},
+  {"unpack", packer_unpack},
+  {"unpackmany", packer_unpackmany},
+  {NULL, NULL}
+};
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** STRING BUFFERS
+** =======================================================
+*/
+
+/*
+** A string buffer is a mutable string that grows in place, so that
+** building a string piece by piece copies each byte once (amortized)
+** and creates no intermediate strings, unlike 's = s .. piece'.
+** Its contents live in a userdata box kept as the buffer's user
+** value (as 'luaL_Buffer' does), so that the collector accounts for
+** them and a failed allocation raises a memory error.
+*/
+
+#define LUA_STRBUFHANDLE	"STRBUF*"
+
+/* largest size of a string buffer */
+#define MAXBUFSIZE	((~(size_t)0) / 2)
+
+typedef struct StrBuf {
+  char *b;  /* contents (the box) */
+  size_t n;  /* number of bytes in use */
+  size_t size;  /* size of the box */
+} StrBuf;
+
+
+#define tostrbuf(L)	((StrBuf *)luaL_checkudata(L, 1, LUA_STRBUFHANDLE))
+
+
+/*
+** Make room for 'sz' more bytes and return where they go. The buffer
+** must be at index 1. A larger box replaces the old one, which stays
+** alive (as the user value) until the contents are copied.
+*/
+static char *prepstrbuf (lua_State *L, StrBuf *sb, size_t sz) {
+  if (sb->size - sb->n < sz) {
+    size_t newsize = (sb->size < 32) ? 32 : sb->size * 2;
+    char *nb;
+    if (sz > MAXBUFSIZE - sb->n)
+      luaL_error(L, "string buffer too large");
+    if (newsize < sb->n + sz)
+      newsize = sb->n + sz;
+    nb = (char *)lua_newuserdata(L, newsize);
+    if (sb->n > 0)
+      memcpy(nb, sb->b, sb->n);
+    lua_setuservalue(L, 1);
+    sb->b = nb;
+    sb->size = newsize;
+  }
+  return sb->b + sb->n;
+}
+
+
+/* append arguments 'first' to top, strings, numbers or buffers */
+static void putstrbuf (lua_State *L, StrBuf *sb, int first) {
+  int top = lua_gettop(L);
+  int i;
+  for (i = first; i <= top; i++) {
+    size_t l;
+    const char *s;
+    StrBuf *other = (StrBuf *)luaL_testudata(L, i, LUA_STRBUFHANDLE);
+    if (other != NULL) {
+      l = other->n;
+      prepstrbuf(L, sb, l);  /* before taking 'b', as 'other' may be 'sb' */
+      s = other->b;
+    }
+    else {
+      s = lua_tolstring(L, i, &l);
+      if (s == NULL)
+        luaL_error(L, "invalid value (a %s) for string buffer",
+                      luaL_typename(L, i));
+    }
+    memcpy(prepstrbuf(L, sb, l), s, l);
+    sb->n += l;
+  }
+}
+
+
+static int strbuf_new (lua_State *L) {
+  StrBuf *sb = (StrBuf *)lua_newuserdata(L, sizeof(StrBuf));
+  sb->b = NULL;
+  sb->n = sb->size = 0;
+  luaL_setmetatable(L, LUA_STRBUFHANDLE);
+  lua_insert(L, 1);
+  putstrbuf(L, sb, 2);
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int strbuf_put (lua_State *L) {
+  putstrbuf(L, tostrbuf(L), 2);
+  lua_settop(L, 1);
+  return 1;  /* return the buffer */
+}
+
+
+static int strbuf_putf (lua_State *L) {
+  StrBuf *sb = tostrbuf(L);
+  lua_pushcfunction(L, str_format);
+  lua_insert(L, 2);
+  lua_call(L, lua_gettop(L) - 2, 1);
+  putstrbuf(L, sb, 2);
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int strbuf_tostring (lua_State *L) {
+  StrBuf *sb = tostrbuf(L);
+  lua_pushlstring(L, sb->b, sb->n);
+  return 1;
+}
+
+
+static int strbuf_len (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)tostrbuf(L)->n);
+  return 1;
+}
+
+
+/* empty the buffer, keeping its memory for reuse */
+static int strbuf_reset (lua_State *L) {
+  tostrbuf(L)->n = 0;
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static const luaL_Reg strbuflib[] = {
+  {"put", strbuf_put},
+  {"putf", strbuf_putf},
+  {"reset", strbuf_reset},
+  {"tostring", strbuf_tostring},
+  {"__len", strbuf_len},
+  {"__tostring", strbuf_tostring},
+  {NULL, NULL}
+};
+
 /* }====================================================== */
 
 
 static const luaL_Reg strlib[] = {
+  {"buffer", strbuf_new},
   {"byte", str_byte},
   {"char", str_char},
   {"dump", str_dump},
+  {"fields", str_fields},
   {"find", str_find},
   {"format", str_format},
   {"gmatch", gmatch},
@@ -1440,9 +2784,11 @@ static const luaL_Reg strlib[] = {
   {"match", str_match},
   {"rep", str_rep},
   {"reverse", str_reverse},
+  {"split", str_split},
   {"sub", str_sub},
   {"upper", str_upper},
   {"pack", str_pack},
+  {"packer", packer_new},
   {"packsize", str_packsize},
   {"unpack", str_unpack},
   {NULL, NULL}
@@ -1461,12 +2807,26 @@ static void createmetatable (lua_State *L) {
 }
 
 
+/* create metatable 'tname' with methods 'l' */
+static void createclass (lua_State *L, const char *tname, const luaL_Reg *l) {
+  luaL_newmetatable(L, tname);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");  /* metatable.__index = metatable */
+  luaL_setfuncs(L, l, 0);
+  lua_pop(L, 1);  /* pop metatable */
+}
+
+
 /*
 ** Open string library
 */
 LUAMOD_API int luaopen_string (lua_State *L) {
-  luaL_newlib(L, strlib);
+  luaL_newlibtable(L, strlib);
+  lua_createtable(L, PCACHESIZE, 0);  /* cache of compiled patterns */
+  luaL_setfuncs(L, strlib, 1);
   createmetatable(L);
+  createclass(L, LUA_STRBUFHANDLE, strbuflib);  /* string buffers */
+  createclass(L, LUA_PACKERHANDLE, packerlib);  /* compiled pack formats */
   return 1;
 }
 
@@ -177,6 +177,11 @@ static unsigned int arrayindex (const TValue *key) {
  * 起始位置是 1.
  * key 为 nil 返回 0，key 若不存在则会报运行时错误
  */
+/*
+** 'nexthint' is the position (as returned by 'findindex') of the last
+** hash key given by 'luaH_next', which is usually the key of the next
+** call in a traversal. It is only a guess, checked against the key.
+*/
 static unsigned int findindex (lua_State *L, Table *t, StkId key) {
   unsigned int i;
   if (ttisnil(key)) return 0;  /* first iteration */
@@ -185,7 +190,12 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
     return i;  /* yes; that's the index */
   else {
     int nx;
-    Node *n = mainposition(t, key);
+    Node *n;
+    i = t->nexthint - t->sizearray - 1;  /* index of hinted node */
+    if (i < cast(unsigned int, sizenode(t)) &&
+        luaV_rawequalobj(gkey(gnode(t, i)), key))
+      return t->nexthint;
+    n = mainposition(t, key);
     for (;;) {  /* check whether 'key' is somewhere in the chain */
       /* key may be dead already, but it is ok to use it in 'next' */
       if (luaV_rawequalobj(gkey(n), key) ||
@@ -228,6 +238,7 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
       setobj2s(L, key, gkey(gnode(t, i)));
       setobj2s(L, key+1, gval(gnode(t, i)));
+      t->nexthint = (i + 1) + t->sizearray;
       return 1;
     }
   }
@@ -430,6 +441,71 @@ void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize) {
   luaH_resize(L, t, nasize, nsize);
 }
 
+
+/*
+** Make room for at least 'nasize' entries in the array part and
+** 'nhsize' in the hash part of 't'; parts never shrink.
+*/
+void luaH_reserve (lua_State *L, Table *t, unsigned int nasize,
+                                           unsigned int nhsize) {
+  unsigned int oldhsize = isdummy(t->node) ? 0 : sizenode(t);
+  if (nasize <= t->sizearray && nhsize <= oldhsize)
+    return;  /* already big enough */
+  if (nasize < t->sizearray) nasize = t->sizearray;
+  if (nhsize < oldhsize) nhsize = oldhsize;
+  luaH_resize(L, t, nasize, nhsize);
+}
+
+
+/*
+** Remove all entries from 't', keeping its array and hash parts
+** allocated for reuse.
+*/
+void luaH_clear (Table *t) {
+  unsigned int i;
+  for (i = 0; i < t->sizearray; i++)
+    setnilvalue(&t->array[i]);
+  if (!isdummy(t->node)) {
+    int size = sizenode(t);
+    int j;
+    for (j = 0; j < size; j++) {
+      Node *n = gnode(t, j);
+      gnext(n) = 0;
+      setnilvalue(wgkey(n));
+      setnilvalue(gval(n));
+    }
+    t->lastfree = gnode(t, size);  /* all positions are free */
+  }
+  t->flags = cast_byte(~0);  /* no tag methods in it */
+  t->lenhint = 0;
+}
+
+/*
+** Check whether the array part can keep its size without being
+** counted. 'nums' has the 'nhint' integer keys out of the array part.
+** With at most 'sizearray + nhint' integer keys in the table, the
+** array part cannot grow beyond twice that, so keys above it cannot
+** move into it. If no key is below that limit, the array part can
+** only stay or shrink. In that case its count (which costs more than
+** the rehash itself when the array part is the largest one) is not
+** worth it, and shrinking is left to a rehash where it is cheap.
+*/
+static int keeparray (const Table *t, const unsigned int *nums,
+                      unsigned int nhint, unsigned int totaluse) {
+  lua_Unsigned limit = 2 * (cast(lua_Unsigned, t->sizearray) + nhint);
+  lua_Unsigned twotoi;  /* 2^i */
+  int i;
+  if (t->sizearray < totaluse)  /* counting the array part is cheap? */
+    return 0;
+  for (i = 0, twotoi = 1; i <= MAXABITS && twotoi/2 < limit;
+       i++, twotoi *= 2) {
+    if (nums[i] > 0)  /* some key in range (2^(i - 1), 2^i]? */
+      return 0;
+  }
+  return 1;
+}
+
+
 /*
 ** nums[i] = number of keys 'k' where 2^(i - 1) < k <= 2^i
 */
@@ -442,12 +518,18 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
   int i;
   int totaluse;
   for (i = 0; i <= MAXABITS; i++) nums[i] = 0;  /* reset counts */
-  nasize = numusearray(t, nums);  /* count keys in array part */
-  totaluse = nasize;  /* all those keys are integer keys */
-  totaluse += numusehash(t, nums, &nasize);  /* count keys in hash part */
+  nasize = 0;
+  totaluse = numusehash(t, nums, &nasize);  /* count keys in hash part */
   /* count extra key */
   nasize += countint(ek, nums);
   totaluse++;
+  if (keeparray(t, nums, nasize, totaluse)) {
+    luaH_resize(L, t, t->sizearray, totaluse);  /* only hash part grows */
+    return;
+  }
+  na = numusearray(t, nums);  /* count keys in array part */
+  nasize += na;
+  totaluse += na;  /* all those keys are integer keys */
   /* 此时的nasize: table 中整数key的数目, 即 nums 数组元素之和 */
 
   /* compute new size for array part */
@@ -471,6 +553,8 @@ Table *luaH_new (lua_State *L) {
   t->flags = cast_byte(~0);
   t->array = NULL;
   t->sizearray = 0;
+  t->lenhint = 0;
+  t->nexthint = 0;
   setnodevector(L, t, 0);
   return t;
 }
@@ -719,22 +803,45 @@ static int unbound_search (Table *t, unsigned int j) {
 }
 
 
+/* is 'i' (smaller than the array size) a boundary of 't'? */
+#define isarrayborder(t,i)  \
+	(((i) == 0 || !ttisnil(&(t)->array[(i) - 1])) && \
+	 ttisnil(&(t)->array[i]))
+
+
 /*
 ** Try to find a boundary in table 't'. A 'boundary' is an integer index
 ** such that t[i] is non-nil and t[i+1] is nil (and 0 if t[1] is nil).
+** 'lenhint' keeps the last boundary found in the array part. It is
+** only a hint, checked before use, so nothing else needs to keep it
+** up to date; as appends and removals at the end of a sequence move
+** the boundary by one, it also tries the neighbors of the hint. It
+** only replaces the binary search: when the last element of the array
+** part is present, the boundary is searched after it, as it always
+** was (so that '#{nil, x}' and '#{...}' with holes give the size).
 */
 /* 先在 array 中找，再在 hash part 中找 */ 
 int luaH_getn (Table *t) {
   unsigned int j = t->sizearray;
   if (j > 0 && ttisnil(&t->array[j - 1])) {
-    /* there is a boundary in the array part: (binary) search for it */
+    /* there is a boundary in the array part: try the hint, then
+       (binary) search for it */
+    unsigned int h = t->lenhint;
     unsigned int i = 0;
+    if (h < j) {
+      if (isarrayborder(t, h))
+        return h;
+      else if (h + 1 < j && isarrayborder(t, h + 1))  /* after an append? */
+        return (t->lenhint = h + 1);
+      else if (h > 0 && isarrayborder(t, h - 1))  /* after a removal? */
+        return (t->lenhint = h - 1);
+    }
     while (j - i > 1) {
       unsigned int m = (i+j)/2;
       if (ttisnil(&t->array[m - 1])) j = m;
       else i = m;
     }
-    return i;
+    return (t->lenhint = i);
   }
   /* else must find a boundary in hash part */
   else if (isdummy(t->node))  /* hash part is empty? */
@@ -66,6 +66,9 @@ LUAI_FUNC Table *luaH_new (lua_State *L);
 LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                                     unsigned int nhsize);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize);
+LUAI_FUNC void luaH_reserve (lua_State *L, Table *t, unsigned int nasize,
+                                                     unsigned int nhsize);
+LUAI_FUNC void luaH_clear (Table *t);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 /**
  * 首先查找 key 在 table 中的索引顺序位置，查找顺序是先array，再 
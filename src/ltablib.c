@@ -267,6 +267,57 @@ static int unpack (lua_State *L) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Preallocation
+** =======================================================
+*/
+
+static int checksize (lua_State *L, int arg) {
+  lua_Integer n = luaL_optinteger(L, arg, 0);
+  luaL_argcheck(L, 0 <= n && n <= INT_MAX, arg, "size out of range");
+  return (int)n;
+}
+
+/*
+ * Returns a new empty table with room for narr sequence elements
+ * and nhash other elements.
+ */
+static int tnew (lua_State *L) {
+  int narr = checksize(L, 1);
+  int nhash = checksize(L, 2);
+  lua_createtable(L, narr, nhash);
+  return 1;
+}
+
+/*
+ * Grows table t so that it holds at least narr sequence elements and
+ * nhash other elements without rehashing. Returns t.
+ */
+static int treserve (lua_State *L) {
+  int narr, nhash;
+  luaL_checktype(L, 1, LUA_TTABLE);
+  narr = checksize(L, 2);
+  nhash = checksize(L, 3);
+  lua_reservetable(L, 1, narr, nhash);
+  lua_settop(L, 1);
+  return 1;
+}
+
+/*
+ * Removes all (raw) entries of table t, keeping its allocated space.
+ * Returns t.
+ */
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  lua_settop(L, 1);
+  return 1;
+}
+
+/* }====================================================== */
+
+
 
 /*
 ** {======================================================
@@ -384,6 +435,9 @@ static int sort (lua_State *L) {
   if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
     luaL_checktype(L, 2, LUA_TFUNCTION);
   lua_settop(L, 2);  /* make sure there are two arguments */
+  if (ta.geti == lua_rawgeti && ta.seti == lua_rawseti &&
+      lua_sort(L, 1, n, lua_isnil(L, 2) ? 0 : 2))
+    return 0;  /* sorted directly in the array part */
   auxsort(L, &ta, 1, n);
   return 0;
 }
@@ -402,6 +456,9 @@ static const luaL_Reg tab_funcs[] = {
   {"remove", tremove},
   {"move", tmove},
   {"sort", sort},
+  {"new", tnew},
+  {"reserve", treserve},
+  {"clear", tclear},
   {NULL, NULL}
 };
 
@@ -78,6 +78,19 @@ typedef struct lua_State lua_State;
 #define LUA_NUMTAGS		9
 
 
+/* element types of typed arrays */
+#define LUA_AINTEGER		1	/* lua_Integer */
+#define LUA_AFLOAT		2	/* lua_Number */
+#define LUA_AINT32		3	/* 32-bit integer */
+#define LUA_AFLOAT32		4	/* float */
+
+/* size in bytes of an element of a typed array of type 't' */
+#define lua_arrayelemsize(t)  \
+	((t) == LUA_AINTEGER ? sizeof(lua_Integer) : \
+	 (t) == LUA_AFLOAT ? sizeof(lua_Number) : \
+	 (t) == LUA_AINT32 ? sizeof(LUA_INT32) : sizeof(float))
+
+
 
 /* minimum Lua stack available to a C function */
 #define LUA_MINSTACK	20
@@ -142,6 +155,12 @@ typedef int (*lua_Writer) (lua_State *L, const void *p, size_t sz, void *ud);
 typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 
 
+/*
+** Type for functions that release the contents of external strings
+*/
+typedef void (*lua_Release) (void *ud, const char *s, size_t len);
+
+
 
 /*
 ** generic extra include file
@@ -243,6 +262,13 @@ LUA_API lua_CFunction   (lua_tocfunction) (lua_State *L, int idx);
  * 若元素不是 Udata 类型返回 NULL
  */
 LUA_API void	       *(lua_touserdata) (lua_State *L, int idx);
+/*
+ * If the value at the given index is a typed array, returns its memory
+ * and sets *type and *n (when not NULL) to its element type and number
+ * of elements. Otherwise, returns NULL.
+ */
+LUA_API void	       *(lua_toarray) (lua_State *L, int idx, int *type,
+                                       size_t *n);
 LUA_API lua_State      *(lua_tothread) (lua_State *L, int idx);
 LUA_API const void     *(lua_topointer) (lua_State *L, int idx);
 
@@ -297,6 +323,8 @@ LUA_API void        (lua_pushinteger) (lua_State *L, lua_Integer n);
  */
 LUA_API const char *(lua_pushlstring) (lua_State *L, const char *s, size_t len);
 LUA_API const char *(lua_pushstring) (lua_State *L, const char *s);
+LUA_API const char *(lua_pushexternalstring) (lua_State *L, const char *s,
+                                   size_t len, lua_Release release, void *ud);
 LUA_API const char *(lua_pushvfstring) (lua_State *L, const char *fmt,
                                                       va_list argp);
 LUA_API const char *(lua_pushfstring) (lua_State *L, const char *fmt, ...);
@@ -332,10 +360,18 @@ LUA_API int (lua_rawgeti) (lua_State *L, int idx, lua_Integer n);
 LUA_API int (lua_rawgetp) (lua_State *L, int idx, const void *p);
 
 LUA_API void  (lua_createtable) (lua_State *L, int narr, int nrec);
+LUA_API void  (lua_reservetable) (lua_State *L, int idx, int narr, int nrec);
+LUA_API void  (lua_cleartable) (lua_State *L, int idx);
 /**
  * 分配一个大小为 size 的Udata型数据在栈顶，并返回Udata数据区域的指针
  */
 LUA_API void *(lua_newuserdata) (lua_State *L, size_t sz);
+/*
+ * Pushes a new typed array with n elements of the given type (one of
+ * the LUA_A* constants), all zero, and returns its memory. Integer
+ * keys 1..n index the elements directly.
+ */
+LUA_API void *(lua_newarray) (lua_State *L, int type, size_t n);
 /*
  * If the value at the given index has a metatable, the function pushes
  * that metatable onto the stack and returns 1. Otherwise, the function
@@ -447,7 +483,41 @@ LUA_API int   (lua_next) (lua_State *L, int idx);
 LUA_API void  (lua_concat) (lua_State *L, int n);
 LUA_API void  (lua_len)    (lua_State *L, int idx);
 
+/*
+ * Sorts in place the raw entries t[1..n] of the table at the given
+ * index, using the function at stack index 'comp' as the order (or
+ * the '<' operator when 'comp' is 0). Returns 0, doing nothing, when
+ * these entries are not all in the array part of the table.
+ */
+LUA_API int   (lua_sort)   (lua_State *L, int idx, lua_Integer n, int comp);
+/*
+ * Copy (as floats) the raw entries t[i..i+n-1] of the table at the
+ * given index into 'buf', and back from 'buf'. Both stop at the first
+ * entry that is not a number in the array part of the table (so that
+ * no key is ever added) and return the number of entries copied.
+ * lua_getintegers and lua_setintegers do the same with integers;
+ * lua_getintegers also stops at the first float.
+ */
+LUA_API size_t  (lua_getnumbers) (lua_State *L, int idx, lua_Integer i,
+                                  size_t n, lua_Number *buf);
+LUA_API size_t  (lua_setnumbers) (lua_State *L, int idx, lua_Integer i,
+                                  size_t n, const lua_Number *buf);
+LUA_API size_t  (lua_getintegers) (lua_State *L, int idx, lua_Integer i,
+                                   size_t n, lua_Integer *buf);
+LUA_API size_t  (lua_setintegers) (lua_State *L, int idx, lua_Integer i,
+                                   size_t n, const lua_Integer *buf);
+
 LUA_API size_t   (lua_stringtonumber) (lua_State *L, const char *s);
+/*
+ * Write (followed by a '\0') integer 'i' in decimal, float 'x' in the
+ * format LUA_NUMBER_FMT, or float 'x' with 'prec' decimals ("%.<prec>f")
+ * into 'buff', which needs room for 50 chars, and return the length of
+ * the result. The float ones return 0, writing nothing, when they cannot
+ * give the exact result of 'sprintf' in the current locale.
+ */
+LUA_API int      (lua_integer2buff) (char *buff, lua_Integer i);
+LUA_API int      (lua_number2buff) (char *buff, lua_Number x);
+LUA_API int      (lua_fixed2buff) (char *buff, lua_Number x, int prec);
 
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void      (lua_setallocf) (lua_State *L, lua_Alloc f, void *ud);
@@ -72,6 +72,43 @@
 #endif
 
 
+/*
+@@ LUA_USE_BUILTINJMP makes Lua recover from errors with the compiler
+** builtins '__builtin_setjmp'/'__builtin_longjmp' instead of '_setjmp'/
+** '_longjmp' (see 'LUAI_THROW' in ldo.c). They save less state, which
+** speeds up every protected call. Only x86 targets use them by default
+** (clang rejects them on others, such as AArch64); define
+** LUA_USE_LONGJMP to turn it off.
+*/
+#if defined(LUA_USE_POSIX) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__)) && !defined(LUA_USE_LONGJMP)
+#define LUA_USE_BUILTINJMP
+#endif
+
+
+/*
+@@ LUA_USE_JIT compiles hot Lua functions to machine code (see ljit.c).
+** It is off by default; define it (e.g. with MYCFLAGS=-DLUA_USE_JIT)
+** to turn it on. It needs x86-64 and 'mmap', and is ignored elsewhere.
+*/
+#if defined(LUA_USE_JIT) && !(defined(LUA_USE_LINUX) && defined(__x86_64__))
+#undef LUA_USE_JIT
+#endif
+
+
+/*
+@@ LUA_USE_SIMD lets the standard libraries use vector instructions
+** for bulk work: the array kernels (SSE2 and AVX2, in larraylib.c),
+** plain substring search, 'string.lower', 'string.upper' and
+** 'string.reverse' (SSE2, in lstrlib.c), and UTF-8 validation (SSSE3,
+** in lutf8lib.c). AVX2 and SSSE3 code runs only on CPUs that have them.
+** Define LUA_NOSIMD to turn it off.
+*/
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(LUA_NOSIMD)
+#define LUA_USE_SIMD
+#endif
+
+
 /*
 @@ LUA_C89_NUMBERS ensures that Lua uses the largest types available for
 ** C89 ('long' and 'double'); Windows always has '__int64', so it does
@@ -466,6 +503,22 @@
       (*(p) = (LUA_INTEGER)(n), 1))
 
 
+/*
+@@ lua_numbertofloat converts a float number to a C 'float', as stored
+** in float32 typed arrays. Numbers beyond the range of 'float' become
+** infinities, as in IEEE arithmetic. (A plain cast would have undefined
+** behavior for them.)
+*/
+#if defined(lvm_c) || defined(larraylib_c)
+#include <float.h>
+#include <math.h>
+
+#define lua_numbertofloat(n) \
+  ((n) > (LUA_NUMBER)FLT_MAX ? (float)HUGE_VAL : \
+   (n) < -(LUA_NUMBER)FLT_MAX ? -(float)HUGE_VAL : (float)(n))
+#endif
+
+
 /*
 @@ The luai_num* macros define the primitive operations over numbers.
 ** They should work for any size of floating numbers.
@@ -648,6 +701,17 @@
 #endif
 #endif
 
+
+/*
+@@ LUA_INT32 is the C type of the elements of 'int32' typed arrays
+** (the smallest of 'int' and 'long' with at least 32 bits).
+*/
+#if LUAI_BITSINT >= 32
+#define LUA_INT32	int
+#else
+#define LUA_INT32	long
+#endif
+
 /* }================================================================== */
 
 
@@ -169,6 +169,7 @@ static void LoadUpvalues (LoadState *S, Proto *f) {
   for (i = 0; i < n; i++) {
     f->upvalues[i].instack = LoadByte(S);
     f->upvalues[i].idx = LoadByte(S);
+    f->upvalues[i].readonly = LoadByte(S);
   }
 }
 
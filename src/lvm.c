@@ -21,6 +21,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -160,6 +161,68 @@ static int forlimit (const TValue *obj, lua_Integer *p, lua_Integer step,
 }
 
 
+/*
+** Get the integer value of a key for typed arrays (numbers with an
+** exact integer value, as with table keys)
+*/
+static int arraykey (const TValue *key, lua_Integer *i) {
+  if (ttisinteger(key)) {
+    *i = ivalue(key);
+    return 1;
+  }
+  else
+    return (ttisfloat(key) && tointeger_aux(key, i, 0));
+}
+
+
+/*
+** 'val = u[i]' for typed array 'u' (nil out of bounds)
+*/
+static void arrayget (Udata *u, lua_Integer i, StkId val) {
+  void *a = getudatamem(u);
+  if (l_castS2U(i) - 1u >= arraylen(u))  /* 'i' not in [1, n]? */
+    setnilvalue(val);
+  else switch (u->arraytype) {
+    case LUA_AINTEGER: setivalue(val, cast(lua_Integer *, a)[i - 1]); break;
+    case LUA_AFLOAT: setfltvalue(val, cast(lua_Number *, a)[i - 1]); break;
+    case LUA_AINT32: setivalue(val, cast(l_int32 *, a)[i - 1]); break;
+    default: setfltvalue(val, cast_num(cast(float *, a)[i - 1])); break;
+  }
+}
+
+
+/*
+** 'u[i] = v' for typed array 'u'
+*/
+static void arrayset (lua_State *L, Udata *u, lua_Integer i,
+                      const TValue *v) {
+  void *a = getudatamem(u);
+  if (l_castS2U(i) - 1u >= arraylen(u))
+    luaG_runerror(L, "typed array index out of range");
+  if (u->arraytype == LUA_AINTEGER || u->arraytype == LUA_AINT32) {
+    lua_Integer n;
+    if (!arraykey(v, &n))
+      luaG_runerror(L, "integer expected for typed array element");
+    if (u->arraytype == LUA_AINTEGER)
+      cast(lua_Integer *, a)[i - 1] = n;
+    else if (l_castS2U(n) + 0x80000000u <= 0xFFFFFFFFu)  /* fits? */
+      cast(l_int32 *, a)[i - 1] = cast(l_int32, n);
+    else
+      luaG_runerror(L, "value out of range for int32 array element");
+  }
+  else {
+    lua_Number n;
+    if (ttisfloat(v)) n = fltvalue(v);
+    else if (ttisinteger(v)) n = cast_num(ivalue(v));
+    else luaG_runerror(L, "number expected for typed array element");
+    if (u->arraytype == LUA_AFLOAT)
+      cast(lua_Number *, a)[i - 1] = n;
+    else
+      cast(float *, a)[i - 1] = lua_numbertofloat(n);
+  }
+}
+
+
 /*
 ** Main function for table access (invoking metamethods if needed).
 ** Compute 'val = t[key]'
@@ -169,6 +232,7 @@ void luaV_gettable (lua_State *L, const TValue *t, TValue *key, StkId val) {
   int loop;  /* counter to avoid infinite loops */
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     const TValue *tm;
+    lua_Integer i;
     if (ttistable(t)) {  /* 't' is a table? */
       Table *h = hvalue(t);
       const TValue *res = luaH_get(h, key); /* do a primitive get */
@@ -179,6 +243,11 @@ void luaV_gettable (lua_State *L, const TValue *t, TValue *key, StkId val) {
       }
       /* else will try metamethod */
     }
+    else if (ttisfulluserdata(t) && uvalue(t)->arraytype != 0 &&
+             arraykey(key, &i)) {  /* element of a typed array? */
+      arrayget(uvalue(t), i, val);
+      return;
+    }
     else if (ttisnil(tm = luaT_gettmbyobj(L, t, TM_INDEX)))
       luaG_typeerror(L, t, "index");  /* no metamethod */
     if (ttisfunction(tm)) {  /* metamethod is a function */
@@ -199,6 +268,7 @@ void luaV_settable (lua_State *L, const TValue *t, TValue *key, StkId val) {
   int loop;  /* counter to avoid infinite loops */
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     const TValue *tm;
+    lua_Integer i;
     if (ttistable(t)) {  /* 't' is a table? */
       Table *h = hvalue(t);
       TValue *oldval = cast(TValue *, luaH_get(h, key));
@@ -220,6 +290,11 @@ void luaV_settable (lua_State *L, const TValue *t, TValue *key, StkId val) {
       }
       /* else will try the metamethod */
     }
+    else if (ttisfulluserdata(t) && uvalue(t)->arraytype != 0 &&
+             arraykey(key, &i)) {  /* element of a typed array? */
+      arrayset(L, uvalue(t), i, val);
+      return;
+    }
     else  /* not a table; check metamethod */
       if (ttisnil(tm = luaT_gettmbyobj(L, t, TM_NEWINDEX)))
         luaG_typeerror(L, t, "index");
@@ -265,6 +340,14 @@ static int l_strcmp (const TString *ls, const TString *rs) {
 }
 
 
+/*
+** 'l_strcmp' for other modules
+*/
+int luaV_strcmp (const TString *ls, const TString *rs) {
+  return l_strcmp(ls, rs);
+}
+
+
 /*
 ** Main operation less than; return 'l < r'.
 */
@@ -428,6 +511,10 @@ void luaV_objlen (lua_State *L, StkId ra, const TValue *rb) {
       return;
     }
     default: {  /* try metamethod */
+      if (ttisfulluserdata(rb) && uvalue(rb)->arraytype != 0) {
+        setivalue(ra, cast(lua_Integer, arraylen(uvalue(rb))));  /* array */
+        return;
+      }
       tm = luaT_gettmbyobj(L, rb, TM_LEN);
       if (ttisnil(tm))  /* no metamethod? */
         luaG_typeerror(L, rb, "get length of");
@@ -498,10 +585,32 @@ lua_Integer luaV_shiftl (lua_Integer x, lua_Integer y) {
 }
 
 
+/*
+** check whether two values cannot be told apart by any Lua code: same
+** variant and same contents (unlike 'luaV_rawequalobj', 0 is not 0.0
+** and 0.0 is not -0.0). Collectable values must be the same object.
+*/
+static int sameobj (const TValue *t1, const TValue *t2) {
+  if (rttype(t1) != rttype(t2)) return 0;
+  switch (ttype(t1)) {
+    case LUA_TNIL: return 1;
+    case LUA_TNUMINT: return (ivalue(t1) == ivalue(t2));
+    case LUA_TNUMFLT:
+      return memcmp(&fltvalue(t1), &fltvalue(t2), sizeof(lua_Number)) == 0;
+    case LUA_TBOOLEAN: return bvalue(t1) == bvalue(t2);
+    case LUA_TLIGHTUSERDATA: return pvalue(t1) == pvalue(t2);
+    case LUA_TLCF: return fvalue(t1) == fvalue(t2);
+    default: return gcvalue(t1) == gcvalue(t2);
+  }
+}
+
+
 /*
 ** check whether cached closure in prototype 'p' may be reused, that is,
 ** whether there is a cached closure with the same upvalues needed by
-** new closure to be created.
+** new closure to be created. A read-only upvalue (a variable never
+** assigned after its declaration) only needs to hold the same value,
+** so closures created in a loop over such captures can still be shared.
 */
 static LClosure *getcached (Proto *p, UpVal **encup, StkId base) {
   LClosure *c = p->cache;
@@ -511,7 +620,8 @@ static LClosure *getcached (Proto *p, UpVal **encup, StkId base) {
     int i;
     for (i = 0; i < nup; i++) {  /* check whether it has right upvalues */
       TValue *v = uv[i].instack ? base + uv[i].idx : encup[uv[i].idx]->v;
-      if (c->upvals[i]->v != v)
+      if (c->upvals[i]->v != v &&
+          !(uv[i].readonly && sameobj(c->upvals[i]->v, v)))
         return NULL;  /* wrong upvalue; cannot reuse closure */
     }
   }
@@ -519,28 +629,70 @@ static LClosure *getcached (Proto *p, UpVal **encup, StkId base) {
 }
 
 
+/* value captured by upvalue 'i' of a new closure */
+#define capturedvalue(uv,i,encup,base)  \
+	((uv)[i].instack ? (base) + (uv)[i].idx : (encup)[(uv)[i].idx]->v)
+
+/*
+** check whether the read-only upvalue 'i' of closure 'c' (created from
+** the same prototype) holds 'o', so that a new closure can share it
+*/
+#define canshare(c,i,o)  \
+	((c) != NULL && !upisopen((c)->upvals[i]) && sameobj((c)->upvals[i]->v, o))
+
+
 /*
 ** create a new Lua closure, push it in the stack, and initialize
 ** its upvalues. Note that the closure is not cached if prototype is
 ** already black (which means that 'cache' was already cleared by the
-** GC).
+** GC). Read-only upvalues are copied into the new closure, unless the
+** cached closure holds the same value, which is then shared: closures
+** made in a loop over the same variables need only one copy. The
+** cached closure stays on the stack while the new one is built, as an
+** emergency collection in an allocation could otherwise clear 'cache'
+** and free it between counting its shareable upvalues and sharing them.
 */
 static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
                          StkId ra) {
   int nup = p->sizeupvalues;
   Upvaldesc *uv = p->upvalues;
+  LClosure *c = p->cache;
+  int nflat = 0;
   int i;
-  LClosure *ncl = luaF_newLclosure(L, nup);
+  LClosure *ncl;
+  if (c != NULL) {  /* anchor cached closure */
+    setclLvalue(L, L->top, c);
+    L->top++;
+  }
+  for (i = 0; i < nup; i++) {
+    if (uv[i].readonly && !canshare(c, i, capturedvalue(uv, i, encup, base)))
+      nflat++;
+  }
+  ncl = luaF_newLclosureflat(L, nup, nflat);
   ncl->p = p;
   setclLvalue(L, ra, ncl);  /* anchor new closure in stack */
+  nflat = 0;
   for (i = 0; i < nup; i++) {  /* fill in its upvalues */
-    if (uv[i].instack)  /* upvalue refers to local variable? */
+    /* new closure is white, so we do not need a barrier here */
+    if (uv[i].readonly) {  /* never assigned? */
+      const TValue *v = capturedvalue(uv, i, encup, base);
+      if (!canshare(c, i, v)) {  /* keep a copy in the closure */
+        ncl->upvals[i] = luaF_setflatupval(L, ncl, nflat++, v);
+        continue;
+      }
+      if (isflatupval(c, c->upvals[i]))  /* share copy from cached one */
+        luaF_unflatupval(L, c, i);
+      ncl->upvals[i] = c->upvals[i];
+    }
+    else if (uv[i].instack)  /* upvalue refers to local variable? */
       ncl->upvals[i] = luaF_findupval(L, base + uv[i].idx);
     else  /* get upvalue from enclosing function */
       ncl->upvals[i] = encup[uv[i].idx];
     ncl->upvals[i]->refcount++;
-    /* new closure is white, so we do not need a barrier here */
   }
+  lua_assert(nflat == ncl->nflat);
+  if (c != NULL)
+    L->top--;  /* remove cached closure */
   if (!isblack(p))  /* cache will not break GC invariant? */
     p->cache = ncl;  /* save it on cache for reuse */
 }
@@ -553,7 +705,7 @@ void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->u.l.base;
   Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
-  OpCode op = GET_OPCODE(inst);
+  OpCode op = getBaseOp(GET_OPCODE(inst));
   switch (op) {  /* finish its execution */
     case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_IDIV:
     case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
@@ -656,10 +808,29 @@ void luaV_finishOp (lua_State *L) {
            luai_threadyield(L); )
 
 
+/* call line and count hooks for the instruction just fetched */
+#define vmtrace()  \
+  { if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) && \
+        (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) { \
+      Protect(luaG_traceexec(L)); \
+    } }
+
+
 #define vmdispatch(o)	switch(o)
 #define vmcase(l)	case l:
 #define vmbreak		break
 
+/*
+** second half of a superinstruction: fetch the next instruction,
+** known to be 'o', and go straight to its code at label 'lbl'
+*/
+#define vmchain(o,lbl)  \
+  { i = *(ci->u.l.savedpc++); \
+    lua_assert(GET_OPCODE(i) == o); \
+    vmtrace(); \
+    ra = RA(i); \
+    goto lbl; }
+
 /**
  * 执行 Lua function, 相关调用信息 L->ci 已经设置好的 
  * 
@@ -677,15 +848,14 @@ void luaV_execute (lua_State *L) {
   cl = clLvalue(ci->func);
   k = cl->p->k;
   base = ci->u.l.base;
+  if (ci->u.l.savedpc == cl->p->code)  /* function entry? */
+    luaJ_check(L, ci, cl->p);
   /* main loop of interpreter */
   /* 通过 goto 或 return 指令结束循环 */
   for (;;) {
     Instruction i = *(ci->u.l.savedpc++);
     StkId ra;
-    if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) &&
-        (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) {
-      Protect(luaG_traceexec(L));
-    }
+    vmtrace();
     /* WARNING: several calls may realloc the stack and invalidate 'ra' */
     ra = RA(i);
     lua_assert(base == ci->u.l.base);
@@ -724,12 +894,23 @@ void luaV_execute (lua_State *L) {
         setobj2s(L, ra, cl->upvals[b]->v);
         vmbreak;
       }
+      vmcase(OP_GETUPVALGT) {
+        int b = GETARG_B(i);
+        setobj2s(L, ra, cl->upvals[b]->v);
+        vmchain(OP_GETTABLE, l_gettable);
+      }
       vmcase(OP_GETTABUP) {
         int b = GETARG_B(i);
         Protect(luaV_gettable(L, cl->upvals[b]->v, RKC(i), ra));
         vmbreak;
       }
+      vmcase(OP_GETTABUPGT) {
+        int b = GETARG_B(i);
+        Protect(luaV_gettable(L, cl->upvals[b]->v, RKC(i), ra));
+        vmchain(OP_GETTABLE, l_gettable);
+      }
       vmcase(OP_GETTABLE) {
+       l_gettable:
         Protect(luaV_gettable(L, RB(i), RKC(i), ra));
         vmbreak;
       }
@@ -764,6 +945,12 @@ void luaV_execute (lua_State *L) {
         Protect(luaV_gettable(L, rb, RKC(i), ra));
         vmbreak;
       }
+      vmcase(OP_SELFCALL) {
+        StkId rb = RB(i);
+        setobjs2s(L, ra+1, rb);
+        Protect(luaV_gettable(L, rb, RKC(i), ra));
+        vmchain(OP_CALL, l_call);
+      }
       vmcase(OP_ADD) { 
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
@@ -962,30 +1149,47 @@ void luaV_execute (lua_State *L) {
       vmcase(OP_EQ) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
-        Protect(
-          if (cast_int(luaV_equalobj(L, rb, rc)) != GETARG_A(i))
-            ci->u.l.savedpc++;
-          else
-            donextjump(ci);
-        )
+        int res;
+        if (ttisinteger(rb) && ttisinteger(rc))
+          res = (ivalue(rb) == ivalue(rc));
+        else
+          Protect(res = luaV_equalobj(L, rb, rc));
+        if (res != GETARG_A(i))
+          ci->u.l.savedpc++;
+        else
+          donextjump(ci);
         vmbreak;
       }
       vmcase(OP_LT) {
-        Protect(
-          if (luaV_lessthan(L, RKB(i), RKC(i)) != GETARG_A(i))
-            ci->u.l.savedpc++;
-          else
-            donextjump(ci);
-        )
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        int res;
+        if (ttisinteger(rb) && ttisinteger(rc))
+          res = (ivalue(rb) < ivalue(rc));
+        else if (ttisfloat(rb) && ttisfloat(rc))
+          res = luai_numlt(fltvalue(rb), fltvalue(rc));
+        else
+          Protect(res = luaV_lessthan(L, rb, rc));
+        if (res != GETARG_A(i))
+          ci->u.l.savedpc++;
+        else
+          donextjump(ci);
         vmbreak;
       }
       vmcase(OP_LE) {
-        Protect(
-          if (luaV_lessequal(L, RKB(i), RKC(i)) != GETARG_A(i))
-            ci->u.l.savedpc++;
-          else
-            donextjump(ci);
-        )
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        int res;
+        if (ttisinteger(rb) && ttisinteger(rc))
+          res = (ivalue(rb) <= ivalue(rc));
+        else if (ttisfloat(rb) && ttisfloat(rc))
+          res = luai_numle(fltvalue(rb), fltvalue(rc));
+        else
+          Protect(res = luaV_lessequal(L, rb, rc));
+        if (res != GETARG_A(i))
+          ci->u.l.savedpc++;
+        else
+          donextjump(ci);
         vmbreak;
       }
       vmcase(OP_TEST) {
@@ -1006,8 +1210,10 @@ void luaV_execute (lua_State *L) {
         vmbreak;
       }
       vmcase(OP_CALL) {
-        int b = GETARG_B(i);
-        int nresults = GETARG_C(i) - 1;
+        int b, nresults;
+       l_call:
+        b = GETARG_B(i);
+        nresults = GETARG_C(i) - 1;
         if (b != 0) L->top = ra+b;  /* else previous instruction set top */
         if (luaD_precall(L, ra, nresults)) {  /* C function? */
           if (nresults >= 0) L->top = ci->top;  /* adjust results */
@@ -1074,6 +1280,7 @@ void luaV_execute (lua_State *L) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             setivalue(ra, idx);  /* update internal index... */
             setivalue(ra + 3, idx);  /* ...and external index */
+            luaJ_check(L, ci, cl->p);
           }
         }
         else {  /* floating loop */
@@ -1085,6 +1292,7 @@ void luaV_execute (lua_State *L) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             setfltvalue(ra, idx);  /* update internal index... */
             setfltvalue(ra + 3, idx);  /* ...and external index */
+            luaJ_check(L, ci, cl->p);
           }
         }
         vmbreak;